@@ -1,7 +1,8 @@
 #include "CornerPinPluginMacros.h"
 #include "CornerPinPlugin.h"
 #include "ofxsCoords.h"
-#include "../QuadrangleDistort/QuadrangleDistort.h"
+#include "ofxsMultiThread.h"
+#include <algorithm>
 
 using namespace QuadrangleDistort;
 
@@ -19,6 +20,9 @@ CornerPinPlugin::CornerPinPlugin(OfxImageEffectHandle handle)
     _bottomRight = fetchDouble2DParam(kParamBottomRight);
     _topLeft = fetchDouble2DParam(kParamTopLeft);
     _topRight = fetchDouble2DParam(kParamTopRight);
+    _mapping = fetchChoiceParam(kParamMapping);
+    _filter = fetchChoiceParam(kParamFilter);
+    _showEdgeCoverage = fetchBooleanParam(kParamShowEdgeCoverage);
 }
 
 bool CornerPinPlugin::isIdentity(const IsIdentityArguments &args, 
@@ -32,10 +36,6 @@ bool CornerPinPlugin::isIdentity(const IsIdentityArguments &args,
     return false;
 }
 
-void CornerPinPlugin::getRegionsOfInterest(const RegionsOfInterestArguments &args, RegionOfInterestSetter &rois) {
-    rois.setRegionOfInterest(*_srcClip, _srcClip->getRegionOfDefinition(args.time));
-}
-
 void fromCanonical(OfxPointD p, OfxPointD renderScale, double par, OfxPointD* result) {
     result->x = p.x * renderScale.x / par;
     result->y = p.y * renderScale.y;
@@ -46,25 +46,326 @@ void toCanonical(OfxPointD p, OfxPointD renderScale, double par, OfxPointD* resu
     result->y = p.y / renderScale.y;
 }
 
+void CornerPinPlugin::fetchQuad(double time, OfxPointD renderScale, double par, Quadrangle* quad) {
+    fromCanonical(_bottomLeft->getValueAtTime(time), renderScale, par, &quad->edges[0].p);
+    fromCanonical(_bottomRight->getValueAtTime(time), renderScale, par, &quad->edges[1].p);
+    fromCanonical(_topRight->getValueAtTime(time), renderScale, par, &quad->edges[2].p);
+    fromCanonical(_topLeft->getValueAtTime(time), renderScale, par, &quad->edges[3].p);
+}
+
+void _quadBounds(const Quadrangle& quad, OfxRectD* rect) {
+    rect->x1 = rect->x2 = quad.edges[0].p.x;
+    rect->y1 = rect->y2 = quad.edges[0].p.y;
+    for (int i=1; i < 4; i++) {
+        auto& p = quad.edges[i].p;
+        rect->x1 = std::min(rect->x1, p.x);
+        rect->x2 = std::max(rect->x2, p.x);
+        rect->y1 = std::min(rect->y1, p.y);
+        rect->y2 = std::max(rect->y2, p.y);
+    }
+}
+
+// nothing is drawn outside the quadrangle
+bool CornerPinPlugin::getRegionOfDefinition(const RegionOfDefinitionArguments &args, OfxRectD &rod) {
+    Quadrangle quad;
+    fetchQuad(args.time, {1, 1}, 1, &quad);
+    _quadBounds(quad, &rod);
+    return true;
+}
+
+// With perspective mapping, the source under the window is the bounds of its
+// corners' identity points, as long as the window doesn't reach the horizon.
+// The bilinear mapping's identity points can bulge past its corners'
+// and the mipmap filter wants all the source for its coarse levels,
+// so they fetch the whole source.
+void CornerPinPlugin::getRegionsOfInterest(const RegionsOfInterestArguments &args, RegionOfInterestSetter &rois) {
+    auto srcROD = _srcClip->getRegionOfDefinition(args.time);
+    Quadrangle quad;
+    fetchQuad(args.time, {1, 1}, 1, &quad);
+    QuadrangleHomography homography;
+    if (
+        _mapping->getValueAtTime(args.time) != 1 || _filter->getValueAtTime(args.time) != 0
+        || !quad.initialise() || !homography.initialise(&quad)
+    ) {
+        rois.setRegionOfInterest(*_srcClip, srcROD);
+        return;
+    }
+
+    // nothing outside the quadrangle needs any source
+    OfxRectD quadROD;
+    _quadBounds(quad, &quadROD);
+    OfxRectD window;
+    if (!Coords::rectIntersection(args.regionOfInterest, quadROD, &window)) {
+        rois.setRegionOfInterest(*_srcClip, {0, 0, 0, 0});
+        return;
+    }
+
+    OfxPointD corners[4] = {
+        {window.x1, window.y1}, {window.x2, window.y1},
+        {window.x2, window.y2}, {window.x1, window.y2}
+    };
+    double uvw[3];
+    OfxRectD uvBounds = {1, 1, 0, 0};
+    for (int i=0; i < 4; i++) {
+        homography.inverseHomogeneous(corners[i], uvw);
+        if (uvw[2] <= 0) {
+            rois.setRegionOfInterest(*_srcClip, srcROD);
+            return;
+        }
+        auto u = std::max(0.0, std::min(1.0, uvw[0] / uvw[2]));
+        auto v = std::max(0.0, std::min(1.0, uvw[1] / uvw[2]));
+        uvBounds.x1 = std::min(uvBounds.x1, u);
+        uvBounds.x2 = std::max(uvBounds.x2, u);
+        uvBounds.y1 = std::min(uvBounds.y1, v);
+        uvBounds.y2 = std::max(uvBounds.y2, v);
+    }
+
+    // a couple of pixels extra for the bilinear sampling
+    auto par = _srcClip->getPixelAspectRatio();
+    auto marginX = 2 * par / args.renderScale.x;
+    auto marginY = 2 / args.renderScale.y;
+    auto srcWidth = srcROD.x2 - srcROD.x1;
+    auto srcHeight = srcROD.y2 - srcROD.y1;
+    OfxRectD uvROI = {
+        srcROD.x1 + uvBounds.x1 * srcWidth - marginX,
+        srcROD.y1 + uvBounds.y1 * srcHeight - marginY,
+        srcROD.x1 + uvBounds.x2 * srcWidth + marginX,
+        srcROD.y1 + uvBounds.y2 * srcHeight + marginY
+    };
+    OfxRectD roi;
+    Coords::rectIntersection(uvROI, srcROD, &roi);
+    rois.setRegionOfInterest(*_srcClip, roi);
+}
+
+// Renders rows of the render window, shared out across threads.
+// If they're wanted for the overlay, each thread keeps the polygons of
+// its edge pixels to itself until they're gathered at the end.
+// Given a pyramid, the source is sampled over each pixel's footprint
+// rather than at a point.
+class CornerPinProcessor : public MultiThread::Processor {
+public:
+    CornerPinProcessor(
+        ImageEffect* effect, Image* srcImg, const MipPyramid* pyramid, Image* dstImg, const Quadrangle& quad,
+        const QuadrangleHomography* homography, OfxRectI window, OfxPointD renderScale, double par,
+        bool collectIntersections
+    )
+    : _effect(effect)
+    , _srcImg(srcImg)
+    , _sampler(srcImg)
+    , _pyramid(pyramid)
+    , _dstImg(dstImg)
+    , _quad(quad)
+    , _rasteriser(&_quad)
+    , _homography(homography)
+    , _window(window)
+    , _renderScale(renderScale)
+    , _par(par)
+    , _collectIntersections(collectIntersections)
+    {}
+
+    void process(std::vector<std::vector<OfxPointD>>* intersections) {
+        auto nThreads = std::max(1u, std::min(
+            MultiThread::getNumCPUs(), unsigned(std::max(1, _window.y2 - _window.y1))
+        ));
+        _threadIntersections.assign(nThreads, std::vector<std::vector<OfxPointD>>());
+        multiThread(nThreads);
+        intersections->clear();
+        for (auto& threadIntersections : _threadIntersections) {
+            intersections->insert(intersections->end(), threadIntersections.begin(), threadIntersections.end());
+        }
+    }
+
+    virtual void multiThreadFunction(unsigned int threadIndex, unsigned int threadMax) OVERRIDE FINAL {
+        auto height = _window.y2 - _window.y1;
+        auto y1 = _window.y1 + int(height * double(threadIndex) / threadMax);
+        auto y2 = _window.y1 + int(height * double(threadIndex + 1) / threadMax);
+        auto& intersections = _threadIntersections[threadIndex];
+
+        auto srcComponentCount = _srcImg->getPixelComponentCount();
+        auto dstComponentCount = _dstImg->getPixelComponentCount();
+        auto srcROD = _srcImg->getRegionOfDefinition();
+        auto width = srcROD.x2 - srcROD.x1;
+        auto srcHeight = srcROD.y2 - srcROD.y1;
+
+        OfxPointD p;
+        OfxPointD srcPD;
+        std::vector<float> bilinSrcPix(srcComponentCount);
+        std::vector<OfxPointD> polyPoints;
+        OfxPointD canonPolyPoint;
+        OfxPointD clipPoints[QUADRANGLEDISTORT_MAX_CLIP_POINTS];
+        int clipCount;
+        RowSpan span;
+
+        // the coverage of pixel x of span's row,
+        // keeping the polygon of edge pixels for the overlay
+        auto pixelCoverage = [&](int x, int y) {
+            if (!span.isCovered(x)) {return 0.0;}
+            if (span.isInside(x)) {return 1.0;}
+            if (!_collectIntersections) {
+                return _rasteriser.pixelCoverage(x, y);
+            }
+            auto coverage = _rasteriser.pixelCoverage(x, y, clipPoints, &clipCount);
+            if (coverage > 0 && coverage < 1) {
+                polyPoints.clear();
+                for (int i=0; i < clipCount; i++) {
+                    toCanonical(clipPoints[i], _renderScale, _par, &canonPolyPoint);
+                    polyPoints.push_back(canonPolyPoint);
+                }
+                intersections.push_back(polyPoints);
+            }
+            return coverage;
+        };
+
+        // the source pixels moved through for a step along x (column 0)
+        // and along y (column 1), from the change in identity point
+        double jacobian[2][2];
+        auto setJacobian = [&](double dudx, double dvdx, double dudy, double dvdy) {
+            jacobian[0][0] = dudx * (width - 1);
+            jacobian[1][0] = dvdx * (srcHeight - 1);
+            jacobian[0][1] = dudy * (width - 1);
+            jacobian[1][1] = dvdy * (srcHeight - 1);
+        };
+
+        auto writePixel = [&](float* dstPix, double intersection, OfxPointD srcPD) {
+            if (intersection <= 0) {
+                for (int c=0; c < dstComponentCount; c++, dstPix++) {
+                    *dstPix = 0;
+                }
+                return;
+            }
+            if (_pyramid) {
+                _pyramid->sample(
+                    srcPD.x * (width - 1) + srcROD.x1,
+                    srcPD.y * (srcHeight - 1) + srcROD.y1,
+                    jacobian,
+                    bilinSrcPix.data()
+                );
+            } else {
+                _sampler.sample(
+                    srcPD.x * (width - 1) + srcROD.x1,
+                    srcPD.y * (srcHeight - 1) + srcROD.y1,
+                    bilinSrcPix.data()
+                );
+            }
+            for (int c=0; c < dstComponentCount; c++, dstPix++) {
+                if (c == 3) {
+                    *dstPix = intersection;
+                }
+                else if (c < srcComponentCount) {
+                    *dstPix = bilinSrcPix[c];
+                } else {
+                    *dstPix = 0;
+                }
+            }
+        };
+
+        // a row's coverage, and for bilinear mapping its identity points,
+        // a pixel longer for the mipmap's derivatives along it.
+        // With the mipmap, the next row's are kept too, for those up it.
+        auto rowWidth = _window.x2 - _window.x1;
+        std::vector<double> coverage(rowWidth);
+        std::vector<OfxPointD> identityPoints;
+        std::vector<OfxPointD> nextIdentityPoints;
+        if (!_homography) {
+            identityPoints.resize(rowWidth + 1);
+            if (_pyramid) {
+                nextIdentityPoints.resize(rowWidth + 1);
+                _rasteriser.rowSamples(y1, _window.x1, _window.x2 + 1, NULL, identityPoints.data());
+            }
+        }
+
+        double uvw[3];
+        for (p.y=y1; p.y < y2; p.y++) {
+            if (_effect->abort()) {return;}
+            auto dstPix = (float*)_dstImg->getPixelAddress(_window.x1, p.y);
+            if (!dstPix) {continue;}
+            if (_collectIntersections) {
+                _rasteriser.rowSpan(p.y, &span);
+                for (int x=_window.x1; x < _window.x2; x++) {
+                    coverage[x - _window.x1] = pixelCoverage(x, p.y);
+                }
+            } else {
+                _rasteriser.rowSamples(p.y, _window.x1, _window.x2, coverage.data(), NULL);
+            }
+            if (_homography) {
+                // the identity point is stepped along the row, needing one divide per pixel
+                p.x = _window.x1;
+                _homography->inverseHomogeneous(p, uvw);
+            } else if (_pyramid) {
+                _rasteriser.rowSamples(p.y + 1, _window.x1, _window.x2 + 1, NULL, nextIdentityPoints.data());
+            } else {
+                _rasteriser.rowSamples(p.y, _window.x1, _window.x2, NULL, identityPoints.data());
+            }
+            for (int i=0; i < rowWidth; i++, dstPix += dstComponentCount) {
+                auto intersection = coverage[i];
+                if (intersection > 0) {
+                    if (_homography) {
+                        srcPD.x = uvw[0] / uvw[2];
+                        srcPD.y = uvw[1] / uvw[2];
+                        if (_pyramid) {
+                            // differentiating u/w and v/w
+                            auto& inv = _homography->inverse;
+                            setJacobian(
+                                (inv[0][0] - srcPD.x * inv[2][0]) / uvw[2],
+                                (inv[1][0] - srcPD.y * inv[2][0]) / uvw[2],
+                                (inv[0][1] - srcPD.x * inv[2][1]) / uvw[2],
+                                (inv[1][1] - srcPD.y * inv[2][1]) / uvw[2]
+                            );
+                        }
+                    } else {
+                        srcPD = identityPoints[i];
+                        if (_pyramid) {
+                            // no closed form, so the next pixel along and up
+                            auto& alongPD = identityPoints[i + 1];
+                            auto& upPD = nextIdentityPoints[i];
+                            setJacobian(
+                                alongPD.x - srcPD.x, alongPD.y - srcPD.y,
+                                upPD.x - srcPD.x, upPD.y - srcPD.y
+                            );
+                        }
+                    }
+                }
+                writePixel(dstPix, intersection, srcPD);
+                if (_homography) {
+                    for (int r=0; r < 3; r++) {
+                        uvw[r] += _homography->inverse[r][0];
+                    }
+                }
+            }
+            if (!_homography && _pyramid) {
+                identityPoints.swap(nextIdentityPoints);
+            }
+        }
+    }
+
+private:
+    ImageEffect* _effect;
+    Image* _srcImg;
+    BilinearSampler _sampler;
+    const MipPyramid* _pyramid;
+    Image* _dstImg;
+    Quadrangle _quad;
+    QuadrangleRasteriser _rasteriser;
+    const QuadrangleHomography* _homography;
+    OfxRectI _window;
+    OfxPointD _renderScale;
+    double _par;
+    bool _collectIntersections;
+    std::vector<std::vector<std::vector<OfxPointD>>> _threadIntersections;
+};
+
 // the overridden render function
 void CornerPinPlugin::render(const RenderArguments &args)
 {
     auto_ptr<Image> srcImg(_srcClip->fetchImage(args.time));
-    auto srcComponentCount = srcImg->getPixelComponentCount();
     auto_ptr<Image> dstImg(_dstClip->fetchImage(args.time));
     auto dstComponentCount = dstImg->getPixelComponentCount();
 
-    auto srcROD = srcImg->getRegionOfDefinition();
-    auto width = srcROD.x2 - srcROD.x1;
-    auto height = srcROD.y2 - srcROD.y1;
-
-    auto par = srcImg->getPixelAspectRatio();
+    auto par = dstImg->getPixelAspectRatio();
     Quadrangle quad;
-    fromCanonical(_bottomLeft->getValueAtTime(args.time), args.renderScale, par, &quad.edges[0].p);
-    fromCanonical(_bottomRight->getValueAtTime(args.time), args.renderScale, par, &quad.edges[1].p);
-    fromCanonical(_topRight->getValueAtTime(args.time), args.renderScale, par, &quad.edges[2].p);
-    fromCanonical(_topLeft->getValueAtTime(args.time), args.renderScale, par, &quad.edges[3].p);
-    if (!quad.initialise()) {
+    fetchQuad(args.time, args.renderScale, par, &quad);
+    // no source is fetched for a window outside the quadrangle
+    if (!srcImg.get() || !quad.initialise()) {
         for (int y=args.renderWindow.y1; y < args.renderWindow.y2; y++) {
             auto dstPix = (float*)dstImg->getPixelAddress(args.renderWindow.x1, y);
             for (int x=args.renderWindow.x1; x < args.renderWindow.x2; x++) {
@@ -76,78 +377,97 @@ void CornerPinPlugin::render(const RenderArguments &args)
         return;
     }
 
-    OfxPointD p;
-    OfxPointD srcPD;
-    OfxPointI srcPI;
-    auto_ptr<float> bilinSrcPix(new float[srcComponentCount]);
+    QuadrangleHomography homography;
+    auto perspective = _mapping->getValue() == 1 && homography.initialise(&quad);
+    auto showEdgeCoverage = _showEdgeCoverage->getValue();
+
+    // shared by the render window's threads, and by the frame's other tiles
+    std::shared_ptr<const MipPyramid> pyramid;
+    if (_filter->getValue() == 1) {
+        pyramid = getPyramid(srcImg.get());
+    }
+
     std::vector<std::vector<OfxPointD>> intersections;
-    std::vector<OfxPointD> polyPoints;
-    OfxPointD canonPolyPoint;
-
-    for (p.y=args.renderWindow.y1; p.y < args.renderWindow.y2; p.y++) {
-        auto dstPix = (float*)dstImg->getPixelAddress(args.renderWindow.x1, p.y);
-        for (p.x=args.renderWindow.x1; p.x < args.renderWindow.x2; p.x++) {
-            auto qPoint = QuadranglePixel(&quad, p);
-            if (qPoint.intersection > 0) {
-                if (qPoint.intersection < 1) {
-                    polyPoints.clear();
-                    for (
-                        auto iter = qPoint.intersectionPoly.edges.begin();
-                        iter < qPoint.intersectionPoly.edges.end();
-                        iter++
-                    ) {
-                        toCanonical(iter->p, args.renderScale, par, &canonPolyPoint);
-                        polyPoints.push_back(canonPolyPoint);
-                    }
-                    intersections.push_back(polyPoints);
-                }
-                qPoint.calculateIdentityPoint(&srcPD);
-                srcPI.x = round(srcPD.x * (width - 1) + srcROD.x1);
-                srcPI.y = round(srcPD.y * (height - 1) + srcROD.y1);
-                bilinear(
-                    srcPD.x * (width - 1) + srcROD.x1,
-                    srcPD.y * (height - 1) + srcROD.y1,
-                    srcImg.get(),
-                    bilinSrcPix.get(),
-                    srcComponentCount
-                );
-                for (int c=0; c < dstComponentCount; c++, dstPix++) {
-                    if (c == 3) {
-                        *dstPix = qPoint.intersection;
-                    }
-                    else if (c < srcComponentCount) {
-                        *dstPix = bilinSrcPix.get()[c];
-                        // if (c == 0) {
-                        //     *dstPix = srcPD.x;
-                        // } else if (c == 1) {
-                        //     *dstPix = srcPD.y;
-                        // } else {
-                        //     *dstPix = 0;
-                        // }
-                    } else {
-                        *dstPix = 0;
-                    }                    
-                }
-            } else {
-                for (int i=0; i < dstComponentCount; i++, dstPix++) {
-                    *dstPix = 0;
-                }
-            }
+    CornerPinProcessor(
+        this, srcImg.get(), pyramid.get(), dstImg.get(), quad, perspective ? &homography : NULL,
+        args.renderWindow, args.renderScale, par, showEdgeCoverage
+    ).process(&intersections);
+
+    if (showEdgeCoverage || hasIntersections()) {
+        setIntersections(args.time, args.renderScale, args.renderWindow, intersections);
+        redrawOverlays();
+    }
+}
+
+std::vector<std::vector<OfxPointD>> CornerPinPlugin::getIntersections(double time) {
+    std::vector<std::vector<OfxPointD>> result;
+    _intersectionsLock.lock();
+    if (time == _intersectionsTime) {
+        for (auto& windowIntersections : _intersections) {
+            result.insert(
+                result.end(),
+                windowIntersections.intersections.begin(), windowIntersections.intersections.end()
+            );
         }
     }
-    setIntersections(intersections);
-    redrawOverlays();
+    _intersectionsLock.unlock();
+    return result;
 }
 
-std::vector<std::vector<OfxPointD>> CornerPinPlugin::getIntersections() {
+bool CornerPinPlugin::hasIntersections() {
     _intersectionsLock.lock();
-    auto result = _intersections;
+    auto result = !_intersections.empty();
     _intersectionsLock.unlock();
     return result;
 }
 
-void CornerPinPlugin::setIntersections(std::vector<std::vector<OfxPointD>> intersections) {
+std::shared_ptr<const MipPyramid> CornerPinPlugin::getPyramid(Image* srcImg) {
+    // the host changes an image's identifier whenever its pixels change.
+    // Without one there's nothing to tell a source from the last, so it's built every time.
+    auto sourceId = srcImg->getUniqueIdentifier();
+    if (sourceId.empty()) {
+        return std::make_shared<const MipPyramid>(srcImg);
+    }
+    auto bounds = srcImg->getBounds();
+    std::lock_guard<std::mutex> guard(_pyramidLock);
+    if (
+        !_pyramid || sourceId != _pyramidSourceId
+        || bounds.x1 != _pyramidBounds.x1 || bounds.y1 != _pyramidBounds.y1
+        || bounds.x2 != _pyramidBounds.x2 || bounds.y2 != _pyramidBounds.y2
+    ) {
+        // dropped first, so the last one and its replacement aren't both held
+        _pyramid.reset();
+        _pyramid = std::make_shared<const MipPyramid>(srcImg);
+        _pyramidSourceId = sourceId;
+        _pyramidBounds = bounds;
+    }
+    return _pyramid;
+}
+
+void CornerPinPlugin::setIntersections(
+    double time, OfxPointD renderScale, OfxRectI window,
+    std::vector<std::vector<OfxPointD>> intersections
+) {
     _intersectionsLock.lock();
-    _intersections.assign(intersections.begin(), intersections.end());
+    if (
+        _intersections.empty() || time != _intersectionsTime
+        || renderScale.x != _intersectionsRenderScale.x
+        || renderScale.y != _intersectionsRenderScale.y
+    ) {
+        _intersections.clear();
+        _intersectionsTime = time;
+        _intersectionsRenderScale = renderScale;
+    }
+    // a window rendered again replaces what was drawn there before
+    _intersections.erase(std::remove_if(
+        _intersections.begin(), _intersections.end(),
+        [&](const WindowIntersections& windowIntersections) {
+            OfxRectI overlap;
+            return Coords::rectIntersection(windowIntersections.window, window, &overlap);
+        }
+    ), _intersections.end());
+    if (!intersections.empty()) {
+        _intersections.push_back({window, std::move(intersections)});
+    }
     _intersectionsLock.unlock();
 }
@@ -1,6 +1,9 @@
 #include "ofxsImageEffect.h"
 #include "ofxsMacros.h"
+#include "../QuadrangleDistort/QuadrangleDistort.h"
+#include "../QuadrangleDistort/MipPyramid.h"
 #include <iostream>
+#include <memory>
 #include <mutex>
 
 using namespace OFX;
@@ -11,7 +14,10 @@ class CornerPinPlugin : public ImageEffect
 public:
     CornerPinPlugin(OfxImageEffectHandle handle);
 
-    std::vector<std::vector<OfxPointD>> getIntersections();
+    // the edge pixels' polygons drawn for time, from every render window
+    // of it since the last frame rendered before it
+    std::vector<std::vector<OfxPointD>> getIntersections(double time);
+    bool hasIntersections();
 
 private:
     /* Override the render */
@@ -24,9 +30,20 @@ private:
 #endif
     ) OVERRIDE FINAL;
 
+    virtual bool getRegionOfDefinition(const RegionOfDefinitionArguments &args, OfxRectD &rod) OVERRIDE FINAL;
+
     virtual void getRegionsOfInterest(const RegionsOfInterestArguments &args, RegionOfInterestSetter &rois);
 
-    void setIntersections(std::vector<std::vector<OfxPointD>> intersections);
+    void fetchQuad(double time, OfxPointD renderScale, double par, QuadrangleDistort::Quadrangle* quad);
+
+    // window's polygons in place of any overlapping it, or in place of
+    // all of them when it's a different frame or render scale to the last
+    void setIntersections(
+        double time, OfxPointD renderScale, OfxRectI window,
+        std::vector<std::vector<OfxPointD>> intersections
+    );
+
+    std::shared_ptr<const QuadrangleDistort::MipPyramid> getPyramid(Image* srcImg);
 
 private:
     Clip* _srcClip;
@@ -35,7 +52,25 @@ private:
     Double2DParam* _bottomRight;
     Double2DParam* _topLeft;
     Double2DParam* _topRight;
+    ChoiceParam* _mapping;
+    ChoiceParam* _filter;
+    BooleanParam* _showEdgeCoverage;
 
-    std::vector<std::vector<OfxPointD>> _intersections;
+    class WindowIntersections {
+    public:
+        OfxRectI window;
+        std::vector<std::vector<OfxPointD>> intersections;
+    };
+
+    // tiles and concurrent renders each add their own window's
+    std::vector<WindowIntersections> _intersections;
+    double _intersectionsTime = 0;
+    OfxPointD _intersectionsRenderScale = {1, 1};
     std::mutex _intersectionsLock;
+
+    // the last source's pyramid, so tiles of a frame share one
+    std::shared_ptr<const QuadrangleDistort::MipPyramid> _pyramid;
+    std::string _pyramidSourceId;
+    OfxRectI _pyramidBounds;
+    std::mutex _pyramidLock;
 };
@@ -26,7 +26,7 @@ void CornerPinPluginFactory::describe(ImageEffectDescriptor &desc)
     desc.setSupportsMultipleClipPARs(true);
     desc.setSupportsMultipleClipDepths(false);
     desc.setRenderThreadSafety(eRenderInstanceSafe);
-    desc.setSequentialRender(true);
+    desc.setSequentialRender(false);
 
     desc.setOverlayInteractDescriptor(new CornerPinPluginOverlayDescriptor);
 }
@@ -75,6 +75,38 @@ void CornerPinPluginFactory::describeInContext(ImageEffectDescriptor &desc, Cont
             page->addChild(*param);
         }
     }
+    {
+        auto param = desc.defineChoiceParam(kParamMapping);
+        param->setLabel(kParamMappingLabel);
+        param->setHint(kParamMappingHint);
+        param->appendOption("Bilinear");
+        param->appendOption("Perspective");
+        param->setAnimates(false);
+        if (page) {
+            page->addChild(*param);
+        }
+    }
+    {
+        auto param = desc.defineChoiceParam(kParamFilter);
+        param->setLabel(kParamFilterLabel);
+        param->setHint(kParamFilterHint);
+        param->appendOption("Bilinear");
+        param->appendOption("Mipmap");
+        param->setAnimates(false);
+        if (page) {
+            page->addChild(*param);
+        }
+    }
+    {
+        auto param = desc.defineBooleanParam(kParamShowEdgeCoverage);
+        param->setLabel(kParamShowEdgeCoverageLabel);
+        param->setHint(kParamShowEdgeCoverageHint);
+        param->setDefault(false);
+        param->setAnimates(false);
+        if (page) {
+            page->addChild(*param);
+        }
+    }
 }
 
 ImageEffect* CornerPinPluginFactory::createInstance(OfxImageEffectHandle handle, ContextEnum /*context*/)
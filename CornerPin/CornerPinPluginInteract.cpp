@@ -35,7 +35,7 @@ bool CornerPinPluginInteract::draw(const DrawArgs &args) {
     glVertex2d(p.x, p.y);
     glEnd();
 
-    auto intersections = ((CornerPinPlugin*)_effect)->getIntersections();
+    auto intersections = ((CornerPinPlugin*)_effect)->getIntersections(args.time);
 
     glColor3f(1, 0.5, 0.5);
 
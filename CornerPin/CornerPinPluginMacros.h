@@ -16,3 +16,15 @@
 #define kParamTopLeft "topLeft"
 
 #define kParamTopRight "topRight"
+
+#define kParamMapping "mapping"
+#define kParamMappingLabel "Mapping"
+#define kParamMappingHint "Bilinear stretches the source evenly along the quadrangle's edges. Perspective maps it as a plane seen in perspective, which is also much quicker to render"
+
+#define kParamFilter "filter"
+#define kParamFilterLabel "Filter"
+#define kParamFilterHint "Bilinear samples the source at a single point per pixel, which shimmers where it's shrunk a lot. Mipmap samples a prefiltered copy of the source sized to each pixel's footprint, along the way it's stretched"
+
+#define kParamShowEdgeCoverage "showEdgeCoverage"
+#define kParamShowEdgeCoverageLabel "Show Edge Coverage"
+#define kParamShowEdgeCoverageHint "Draw how each pixel along the edges is cut by the quadrangle in the overlay. Slows rendering down"
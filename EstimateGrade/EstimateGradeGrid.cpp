@@ -0,0 +1,284 @@
+#include "EstimateGradeGrid.h"
+#include "EstimateGradeSampler.h"
+#include <climits>
+#include <cmath>
+#include <limits>
+#include <sstream>
+#include <thread>
+
+
+unsigned int gradeThreadCount() {
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+void gradeMultiThread(MultiThread::Processor* processor, unsigned int nThreads) {
+    nThreads = std::max(1u, nThreads);
+    std::vector<std::thread> threads;
+    for (unsigned int t=1; t < nThreads; t++) {
+        threads.emplace_back(&MultiThread::Processor::multiThreadFunction, processor, t, nThreads);
+    }
+    processor->multiThreadFunction(0, nThreads);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+// GradeImage
+
+void GradeImage::copy(const Image* img) {
+    bounds = img->getBounds();
+    rod = img->getRegionOfDefinition();
+    par = img->getPixelAspectRatio();
+    components = img->getPixelComponentCount();
+    auto rowLength = (bounds.x2 - bounds.x1) * components;
+    data.resize(size_t(rowLength) * (bounds.y2 - bounds.y1));
+    auto dstPix = data.data();
+    for (int y=bounds.y1; y < bounds.y2; y++, dstPix += rowLength) {
+        auto srcPix = (const float*)img->getPixelAddress(bounds.x1, y);
+        std::copy(srcPix, srcPix + rowLength, dstPix);
+    }
+}
+
+// GradeGrid
+
+void GradeGrid::reset(int m, int c, int r, int count) {
+    mapping = m;
+    cols = c;
+    rows = r;
+    cellParamCount = count;
+    params.assign(c * r * count, 0);
+}
+
+bool GradeGrid::matches(int m, int c, int r) const {
+    return (
+        mapping == m && cols == c && rows == r
+        && cellParamCount > 0
+        && params.size() == size_t(c * r * cellParamCount)
+    );
+}
+
+std::string GradeGrid::serialise() const {
+    std::ostringstream out;
+    out.precision(std::numeric_limits<double>::max_digits10);
+    out << mapping << " " << cols << " " << rows << " " << cellParamCount << "\n";
+    auto valPtr = params.begin();
+    for (int i=0; i < cellCount(); i++) {
+        for (int j=0; j < cellParamCount; j++, valPtr++) {
+            if (j) {out << " ";}
+            out << *valPtr;
+        }
+        out << "\n";
+    }
+    return out.str();
+}
+
+bool GradeGrid::deserialise(const std::string& str) {
+    std::istringstream in(str);
+    int m, c, r, count;
+    if (!(in >> m >> c >> r >> count) || c < 1 || r < 1 || count < 1) {
+        reset(-1, 0, 0, 0);
+        return false;
+    }
+    reset(m, c, r, count);
+    for (auto valPtr = params.begin(); valPtr < params.end(); valPtr++) {
+        if (!(in >> *valPtr)) {
+            reset(-1, 0, 0, 0);
+            return false;
+        }
+    }
+    return true;
+}
+
+// CellStats
+
+void CellStats::reset(int bins, int components) {
+    binSums.assign(bins * components, {0, 0});
+    binCounts.assign(bins * components, 0);
+    for (int r=0; r < 3; r++) {
+        for (int c=0; c < 3; c++) {
+            srcSq[r][c] = 0;
+            trgSrc[r][c] = 0;
+        }
+    }
+    matrixCount = 0;
+}
+
+void CellStats::merge(const CellStats& other) {
+    for (size_t i=0; i < binSums.size(); i++) {
+        binSums[i].x += other.binSums[i].x;
+        binSums[i].y += other.binSums[i].y;
+        binCounts[i] += other.binCounts[i];
+    }
+    for (int r=0; r < 3; r++) {
+        for (int c=0; c < 3; c++) {
+            srcSq[r][c] += other.srcSq[r][c];
+            trgSrc[r][c] += other.trgSrc[r][c];
+        }
+    }
+    matrixCount += other.matrixCount;
+}
+
+// GradeStatsAccumulator
+
+GradeStatsAccumulator::GradeStatsAccumulator(
+    const GradeImage* srcImg, const GradeImage* trgImg, int components, OfxRectI isect, double horizScale,
+    bool forMatrix, int bins, int cols, int rows, const std::vector<OfxPointI>* points,
+    const std::atomic<bool>* cancelled
+)
+: _srcImg(srcImg)
+, _trgImg(trgImg)
+, _components(components)
+, _isect(isect)
+, _horizScale(horizScale)
+, _forMatrix(forMatrix)
+, _bins(bins)
+, _cols(cols)
+, _rows(rows)
+, _points(points)
+, _cancelled(cancelled)
+{
+    _gridRect = srcImg->getRegionOfDefinition();
+}
+
+void GradeStatsAccumulator::process(std::vector<CellStats>* cells) {
+    auto cellCount = _cols * _rows;
+    auto binsPerCell = _forMatrix ? 0 : _bins * _components;
+    // don't let the per thread copies of the bins get silly
+    size_t bytesPerThread = (
+        size_t(cellCount) * binsPerCell * (sizeof(OfxPointD) + sizeof(int))
+    );
+    unsigned int nThreads = gradeThreadCount();
+    if (bytesPerThread > 0) {
+        nThreads = std::max(
+            1u, std::min(nThreads, unsigned((size_t(256) << 20) / bytesPerThread))
+        );
+    }
+    nThreads = std::max(1u, std::min(nThreads, sampleThreadLimit(*_points, _isect)));
+    _threadCells.resize(nThreads);
+    for (auto& threadCells : _threadCells) {
+        threadCells.resize(cellCount);
+        for (auto& cellStats : threadCells) {
+            cellStats.reset(_forMatrix ? 0 : _bins, _components);
+        }
+    }
+
+    gradeMultiThread(this, nThreads);
+
+    *cells = std::move(_threadCells[0]);
+    for (unsigned int t=1; t < nThreads; t++) {
+        for (int i=0; i < cellCount; i++) {
+            (*cells)[i].merge(_threadCells[t][i]);
+        }
+    }
+    _threadCells.clear();
+}
+
+void GradeStatsAccumulator::multiThreadFunction(unsigned int threadIndex, unsigned int threadMax) {
+    auto& cells = _threadCells[threadIndex];
+    auto gridWidth = _gridRect.x2 - _gridRect.x1;
+    auto gridHeight = _gridRect.y2 - _gridRect.y1;
+    forEachThreadSample(*_points, _isect, threadIndex, threadMax, _cancelled, [&](int x, int y) {
+        auto srcPix = _srcImg->getPixelAddress(x, y);
+        auto trgPix = _trgImg->getPixelAddress(round(x / _horizScale), y);
+        if (!srcPix || !trgPix) {return;}
+        auto row = std::max(0, std::min(_rows - 1, (y - _gridRect.y1) * _rows / gridHeight));
+        auto col = std::max(0, std::min(_cols - 1, (x - _gridRect.x1) * _cols / gridWidth));
+        auto& cellStats = cells[row * _cols + col];
+        if (_forMatrix) {
+            double srcVal[3];
+            double trgVal[3];
+            for (int c=0; c < 3; c++) {
+                if (c < _components) {
+                    if (std::isnan(srcPix[c]) || std::isnan(trgPix[c])) {return;}
+                    srcVal[c] = srcPix[c];
+                    trgVal[c] = trgPix[c];
+                } else {
+                    srcVal[c] = 0;
+                    trgVal[c] = 0;
+                }
+            }
+            for (int r=0; r < 3; r++) {
+                for (int c=0; c < 3; c++) {
+                    cellStats.srcSq[r][c] += srcVal[r] * srcVal[c];
+                    cellStats.trgSrc[r][c] += trgVal[r] * srcVal[c];
+                }
+            }
+            cellStats.matrixCount++;
+            return;
+        }
+        for (int c=0; c < _components; c++, srcPix++, trgPix++) {
+            if (*srcPix < 0 || *srcPix >= 1) {continue;}
+            int i = c * _bins + int(floor(*srcPix * _bins));
+            cellStats.binSums[i].x += *srcPix;
+            cellStats.binSums[i].y += *trgPix;
+            cellStats.binCounts[i]++;
+        }
+    });
+}
+
+// GradeGridRowEvaluator
+
+GradeGridRowEvaluator::GradeGridRowEvaluator(
+    const std::vector<double>* cellCoeffs, int coeffCount, int cols, int rows, OfxRectI gridRect
+)
+: _cellCoeffs(cellCoeffs)
+, _coeffCount(coeffCount)
+, _cols(cols)
+, _rows(rows)
+, _gridRect(gridRect)
+, _rowCoeffs(cols * coeffCount)
+, _coeffs(coeffCount)
+, _deltas(coeffCount)
+{
+    _colsPerPixel = double(cols) / std::max(1, gridRect.x2 - gridRect.x1);
+}
+
+void GradeGridRowEvaluator::startRow(int y, int x) {
+    // position of the pixel centre in cell centre space
+    auto gridY = (
+        (y + 0.5 - _gridRect.y1) * _rows / std::max(1, _gridRect.y2 - _gridRect.y1) - 0.5
+    );
+    gridY = std::max(0.0, std::min(double(_rows - 1), gridY));
+    int row0 = floor(gridY);
+    int row1 = std::min(row0 + 1, _rows - 1);
+    auto weight = gridY - row0;
+    auto cell0 = _cellCoeffs->data() + row0 * _cols * _coeffCount;
+    auto cell1 = _cellCoeffs->data() + row1 * _cols * _coeffCount;
+    auto rowPtr = _rowCoeffs.data();
+    for (int i=0; i < _cols * _coeffCount; i++, rowPtr++, cell0++, cell1++) {
+        *rowPtr = *cell0 + weight * (*cell1 - *cell0);
+    }
+    _x = x;
+    _started = false;
+    startSpan();
+}
+
+void GradeGridRowEvaluator::startSpan() {
+    auto gridX = (_x + 0.5 - _gridRect.x1) * _colsPerPixel - 0.5;
+    int col;
+    double weight;
+    if (_cols == 1 || gridX >= _cols - 1) {
+        // clamped to the last column for the rest of the row
+        col = _cols - 1;
+        weight = 0;
+        _spanEnd = INT_MAX;
+    } else if (gridX < 0) {
+        // clamped to the first column until the first cell centre
+        col = 0;
+        weight = 0;
+        _spanEnd = ceil(_gridRect.x1 + 0.5 / _colsPerPixel - 0.5);
+    } else {
+        col = floor(gridX);
+        weight = gridX - col;
+        _spanEnd = ceil(_gridRect.x1 + (col + 1.5) / _colsPerPixel - 0.5);
+    }
+    // rounding may leave us short of the next span
+    _spanEnd = std::max(_spanEnd, _x + 1);
+    auto coeffs0 = _rowCoeffs.data() + col * _coeffCount;
+    auto coeffs1 = coeffs0 + (col + 1 < _cols ? _coeffCount : 0);
+    for (int k=0; k < _coeffCount; k++) {
+        auto diff = (gridX >= 0 ? coeffs1[k] - coeffs0[k] : 0);
+        _coeffs[k] = coeffs0[k] + weight * diff;
+        _deltas[k] = diff * _colsPerPixel;
+    }
+}
@@ -0,0 +1,169 @@
+#ifndef ESTIMATEGRADEGRID_H
+#define ESTIMATEGRADEGRID_H
+
+#include "ofxsImageEffect.h"
+#include "ofxsMacros.h"
+#include "ofxsMultiThread.h"
+#include <atomic>
+#include <string>
+#include <vector>
+
+using namespace OFX;
+
+
+// Estimation runs on a thread of its own rather than inside an action,
+// where the host's multithread suite can't be relied on, so processors
+// are run on plain threads instead.
+unsigned int gradeThreadCount();
+void gradeMultiThread(MultiThread::Processor* processor, unsigned int nThreads);
+
+
+// A copy of a fetched image's pixels, so they can still be read once the
+// image has gone back to the host, e.g. from an estimation thread.
+class GradeImage {
+public:
+    OfxRectI bounds;
+    OfxRectI rod;
+    double par = 1;
+    int components = 0;
+    std::vector<float> data;
+
+    void copy(const Image* img);
+    inline OfxRectI getRegionOfDefinition() const {return rod;}
+    inline double getPixelAspectRatio() const {return par;}
+    inline int getPixelComponentCount() const {return components;}
+    inline const float* getPixelAddress(int x, int y) const {
+        if (x < bounds.x1 || x >= bounds.x2 || y < bounds.y1 || y >= bounds.y2) {
+            return NULL;
+        }
+        return data.data() + ((y - bounds.y1) * (bounds.x2 - bounds.x1) + (x - bounds.x1)) * components;
+    }
+};
+
+
+// The fitted parameters of a mapping, one set per cell of a cols x rows
+// grid laid over the source's region of definition.
+// Cells are stored row by row, from the bottom left.
+// For the curve mappings a cell holds each channel's parameters one after
+// the other. For the matrix it holds the 4x4 matrix row by row.
+class GradeGrid {
+public:
+    int mapping = -1;
+    int cols = 0;
+    int rows = 0;
+    int cellParamCount = 0;
+    std::vector<double> params;
+
+    void reset(int m, int c, int r, int count);
+    inline int cellCount() const {return cols * rows;}
+    inline double* cell(int col, int row) {
+        return params.data() + (row * cols + col) * cellParamCount;
+    }
+    inline const double* cell(int col, int row) const {
+        return params.data() + (row * cols + col) * cellParamCount;
+    }
+    bool matches(int m, int c, int r) const;
+
+    std::string serialise() const;
+    bool deserialise(const std::string& str);
+};
+
+
+// What is gathered per cell before fitting.
+// Curve mappings bin source values per channel, keeping the sum of the
+// source and target values falling in each bin.
+// The matrix keeps the sums of the source outer products and the
+// target/source cross products, so it can be solved without keeping samples.
+class CellStats {
+public:
+    std::vector<OfxPointD> binSums;
+    std::vector<int> binCounts;
+    double srcSq[3][3];
+    double trgSrc[3][3];
+    int matrixCount;
+
+    void reset(int bins, int components);
+    void merge(const CellStats& other);
+};
+
+
+// Accumulates the statistics for every cell of the grid in one pass over
+// the sampled points of the intersection of source and target (all of it
+// when there are none), splitting them across threads.
+// Each thread has its own set of stats, which are merged at the end.
+class GradeStatsAccumulator : public MultiThread::Processor {
+public:
+    GradeStatsAccumulator(
+        const GradeImage* srcImg, const GradeImage* trgImg, int components, OfxRectI isect, double horizScale,
+        bool forMatrix, int bins, int cols, int rows, const std::vector<OfxPointI>* points,
+        const std::atomic<bool>* cancelled = NULL
+    );
+
+    void process(std::vector<CellStats>* cells);
+
+    virtual void multiThreadFunction(unsigned int threadIndex, unsigned int threadMax) OVERRIDE FINAL;
+
+private:
+    const GradeImage* _srcImg;
+    const GradeImage* _trgImg;
+    int _components;
+    OfxRectI _isect;
+    OfxRectI _gridRect;
+    double _horizScale;
+    bool _forMatrix;
+    int _bins;
+    int _cols;
+    int _rows;
+    const std::vector<OfxPointI>* _points;
+    const std::atomic<bool>* _cancelled;
+    std::vector<std::vector<CellStats>> _threadCells;
+};
+
+
+// Walks a row of the grid, giving the bilinearly interpolated render
+// coefficients for each pixel. Coefficients are interpolated down the
+// grid once per row, and then stepped incrementally along it.
+class GradeGridRowEvaluator {
+public:
+    // cellCoeffs holds coeffCount render coefficients per cell,
+    // laid out as GradeGrid's params
+    GradeGridRowEvaluator(
+        const std::vector<double>* cellCoeffs, int coeffCount, int cols, int rows, OfxRectI gridRect
+    );
+
+    void startRow(int y, int x);
+
+    // coefficients for the next pixel along the row
+    inline const double* next() {
+        if (_started) {
+            _x++;
+            if (_x >= _spanEnd) {
+                startSpan();
+            } else {
+                for (int k=0; k < _coeffCount; k++) {
+                    _coeffs[k] += _deltas[k];
+                }
+            }
+        }
+        _started = true;
+        return _coeffs.data();
+    }
+
+private:
+    void startSpan();
+
+    const std::vector<double>* _cellCoeffs;
+    int _coeffCount;
+    int _cols;
+    int _rows;
+    OfxRectI _gridRect;
+    double _colsPerPixel;
+    std::vector<double> _rowCoeffs;
+    std::vector<double> _coeffs;
+    std::vector<double> _deltas;
+    int _spanEnd;
+    int _x;
+    bool _started;
+};
+
+#endif // def ESTIMATEGRADEGRID_H
@@ -0,0 +1,406 @@
+#include "EstimateGradeLUT.h"
+#include "EstimateGradeSampler.h"
+#include <cmath>
+#include <fstream>
+#include <limits>
+#include <sstream>
+
+#define LUT_CG_MAX_ITERATIONS 1000
+#define LUT_CG_TOLERANCE 1e-10
+
+// offset of a neighbour within a vertex's 27 normal equation entries
+inline int _neighbourIndex(int dr, int dg, int db) {
+    return (db + 1) * 9 + (dg + 1) * 3 + (dr + 1);
+}
+
+
+// GradeLUT
+
+void GradeLUT::reset(int n) {
+    size = n;
+    data.assign(n * n * n * 3, 0);
+}
+
+void GradeLUT::resetIdentity(int n) {
+    reset(n);
+    auto valPtr = data.begin();
+    for (int b=0; b < n; b++) {
+        for (int g=0; g < n; g++) {
+            for (int r=0; r < n; r++) {
+                *valPtr++ = r / float(n - 1);
+                *valPtr++ = g / float(n - 1);
+                *valPtr++ = b / float(n - 1);
+            }
+        }
+    }
+}
+
+std::string GradeLUT::serialise() const {
+    std::ostringstream out;
+    out.precision(std::numeric_limits<float>::max_digits10);
+    out << size << "\n";
+    for (auto valPtr = data.begin(); valPtr < data.end(); valPtr += 3) {
+        out << valPtr[0] << " " << valPtr[1] << " " << valPtr[2] << "\n";
+    }
+    return out.str();
+}
+
+bool GradeLUT::deserialise(const std::string& str) {
+    std::istringstream in(str);
+    int n;
+    if (!(in >> n) || n < 2) {
+        reset(0);
+        return false;
+    }
+    reset(n);
+    for (auto valPtr = data.begin(); valPtr < data.end(); valPtr++) {
+        if (!(in >> *valPtr)) {
+            reset(0);
+            return false;
+        }
+    }
+    return true;
+}
+
+bool GradeLUT::writeCube(const std::string& path, const std::string& title) const {
+    std::ofstream out(path);
+    if (!out) {return false;}
+    out.precision(std::numeric_limits<float>::max_digits10);
+    out << "TITLE \"" << title << "\"\n";
+    out << "LUT_3D_SIZE " << size << "\n";
+    out << "DOMAIN_MIN 0 0 0\n";
+    out << "DOMAIN_MAX 1 1 1\n";
+    for (auto valPtr = data.begin(); valPtr < data.end(); valPtr += 3) {
+        out << valPtr[0] << " " << valPtr[1] << " " << valPtr[2] << "\n";
+    }
+    return bool(out);
+}
+
+void GradeLUT::applyRow(const float* srcPix, float* dstPix, int count, int components) const {
+    const float maxCoord = size - 1;
+    const int strideR = 3;
+    const int strideG = size * 3;
+    const int strideB = size * size * 3;
+    const float* lattice = data.data();
+    // Pixels go in blocks: first their tetrahedra, with selects rather
+    // than branches so it vectorises, then the lattice lookups.
+    int offsets[GRADELUT_BLOCK][3];
+    float weights[GRADELUT_BLOCK][4];
+    for (int start=0; start < count; start += GRADELUT_BLOCK) {
+        auto blockCount = std::min(GRADELUT_BLOCK, count - start);
+        auto blockSrcPix = srcPix + start * components;
+        for (int i=0; i < blockCount; i++) {
+            auto pix = blockSrcPix + i * components;
+            // position in the lattice, clamped to its domain, NaN to 0
+            float pr = std::min(maxCoord, std::max(0.f, pix[0] * maxCoord));
+            float pg = std::min(maxCoord, std::max(0.f, pix[1] * maxCoord));
+            float pb = std::min(maxCoord, std::max(0.f, pix[2] * maxCoord));
+            int ir = std::min(int(pr), size - 2);
+            int ig = std::min(int(pg), size - 2);
+            int ib = std::min(int(pb), size - 2);
+            float fr = pr - ir;
+            float fg = pg - ig;
+            float fb = pb - ib;
+            // The walk from c000 to c111 steps along the largest fraction
+            // first and the smallest last, so the tetrahedron's weights
+            // are just the sorted fractions' differences. Ties give
+            // zero weights, so any axis can be taken for them, as long
+            // as the largest and smallest are different ones.
+            float hi = std::max(fr, std::max(fg, fb));
+            float lo = std::min(fr, std::min(fg, fb));
+            float mid = fr + fg + fb - hi - lo;
+            bool rIsMax = fr >= fg && fr >= fb;
+            bool gIsMax = !rIsMax && fg >= fb;
+            bool bIsMax = !rIsMax && !gIsMax;
+            bool rIsMin = fr < fg && fr < fb;
+            bool gIsMin = !rIsMin && fg < fb;
+            bool bIsMin = !rIsMin && !gIsMin;
+            offsets[i][0] = ir * strideR + ig * strideG + ib * strideB;
+            offsets[i][1] = offsets[i][0] + rIsMax * strideR + gIsMax * strideG + bIsMax * strideB;
+            offsets[i][2] = (
+                offsets[i][0] + strideR + strideG + strideB
+                - (rIsMin * strideR + gIsMin * strideG + bIsMin * strideB)
+            );
+            weights[i][0] = 1 - hi;
+            weights[i][1] = hi - mid;
+            weights[i][2] = mid - lo;
+            weights[i][3] = lo;
+        }
+        auto blockDstPix = dstPix + start * components;
+        for (int i=0; i < blockCount; i++) {
+            auto c000 = lattice + offsets[i][0];
+            auto c1 = lattice + offsets[i][1];
+            auto c2 = lattice + offsets[i][2];
+            auto c111 = c000 + strideR + strideG + strideB;
+            auto w = weights[i];
+            auto pix = blockSrcPix + i * components;
+            auto outPix = blockDstPix + i * components;
+            // each pixel is read before it's written,
+            // so src and dst can be the same row
+            float out[3];
+            for (int c=0; c < 3; c++) {
+                out[c] = w[0] * c000[c] + w[1] * c1[c] + w[2] * c2[c] + w[3] * c111[c];
+            }
+            for (int c=0; c < 3; c++) {
+                outPix[c] = out[c];
+            }
+            for (int c=3; c < components; c++) {
+                outPix[c] = pix[c];
+            }
+        }
+    }
+}
+
+// LUTStats
+
+void LUTStats::reset(int n) {
+    size = n;
+    normal.assign(n * n * n * 27, 0);
+    rhs.assign(n * n * n * 3, 0);
+    count = 0;
+}
+
+void LUTStats::merge(const LUTStats& other) {
+    for (size_t i=0; i < normal.size(); i++) {
+        normal[i] += other.normal[i];
+    }
+    for (size_t i=0; i < rhs.size(); i++) {
+        rhs[i] += other.rhs[i];
+    }
+    count += other.count;
+}
+
+// GradeLUTAccumulator
+
+GradeLUTAccumulator::GradeLUTAccumulator(
+    const GradeImage* srcImg, const GradeImage* trgImg, int components, OfxRectI isect, double horizScale,
+    int size, const std::vector<OfxPointI>* points, const std::atomic<bool>* cancelled
+)
+: _srcImg(srcImg)
+, _trgImg(trgImg)
+, _components(components)
+, _isect(isect)
+, _horizScale(horizScale)
+, _size(size)
+, _points(points)
+, _cancelled(cancelled)
+{}
+
+void GradeLUTAccumulator::process(LUTStats* stats) {
+    size_t bytesPerThread = size_t(_size) * _size * _size * 30 * sizeof(double);
+    unsigned int nThreads = std::max(
+        1u, std::min(gradeThreadCount(), unsigned((size_t(256) << 20) / bytesPerThread))
+    );
+    nThreads = std::max(1u, std::min(nThreads, sampleThreadLimit(*_points, _isect)));
+    _threadStats.resize(nThreads);
+    for (auto& threadStats : _threadStats) {
+        threadStats.reset(_size);
+    }
+
+    gradeMultiThread(this, nThreads);
+
+    *stats = std::move(_threadStats[0]);
+    for (unsigned int t=1; t < nThreads; t++) {
+        stats->merge(_threadStats[t]);
+    }
+    _threadStats.clear();
+}
+
+void GradeLUTAccumulator::multiThreadFunction(unsigned int threadIndex, unsigned int threadMax) {
+    auto& stats = _threadStats[threadIndex];
+    const double maxCoord = _size - 1;
+    int cornerOffsets[8];
+    int cornerNeighbours[8][8];
+    for (int i=0; i < 8; i++) {
+        cornerOffsets[i] = ((i >> 2) * _size + ((i >> 1) & 1)) * _size + (i & 1);
+        for (int j=0; j < 8; j++) {
+            cornerNeighbours[i][j] = _neighbourIndex(
+                (j & 1) - (i & 1), ((j >> 1) & 1) - ((i >> 1) & 1), (j >> 2) - (i >> 2)
+            );
+        }
+    }
+    double p[3];
+    int base[3];
+    double frac[3];
+    double weights[8];
+    forEachThreadSample(*_points, _isect, threadIndex, threadMax, _cancelled, [&](int x, int y) {
+        auto srcPix = _srcImg->getPixelAddress(x, y);
+        auto trgPix = _trgImg->getPixelAddress(round(x / _horizScale), y);
+        if (!srcPix || !trgPix) {return;}
+        for (int c=0; c < 3; c++) {
+            if (std::isnan(srcPix[c]) || std::isnan(trgPix[c])) {return;}
+            p[c] = std::max(0.0, std::min(maxCoord, srcPix[c] * maxCoord));
+            base[c] = std::min(int(p[c]), _size - 2);
+            frac[c] = p[c] - base[c];
+        }
+        for (int i=0; i < 8; i++) {
+            weights[i] = (
+                (i & 1 ? frac[0] : 1 - frac[0])
+                * ((i >> 1) & 1 ? frac[1] : 1 - frac[1])
+                * (i >> 2 ? frac[2] : 1 - frac[2])
+            );
+        }
+        auto baseIndex = (base[2] * _size + base[1]) * _size + base[0];
+        for (int i=0; i < 8; i++) {
+            auto vertex = baseIndex + cornerOffsets[i];
+            auto normal = stats.normal.data() + vertex * 27;
+            for (int j=0; j < 8; j++) {
+                normal[cornerNeighbours[i][j]] += weights[i] * weights[j];
+            }
+            auto rhs = stats.rhs.data() + vertex * 3;
+            for (int c=0; c < 3; c++) {
+                rhs[c] += weights[i] * trgPix[c];
+            }
+        }
+        stats.count++;
+    });
+}
+
+// fitLUT
+
+// One conjugate gradient solve per channel, all sharing the same
+// (Jacobi preconditioned) sparse system.
+class LUTChannelSolver : public MultiThread::Processor {
+public:
+    LUTChannelSolver(
+        const std::vector<double>* normal, const std::vector<double>* rhs, int size, GradeLUT* lut,
+        const std::atomic<bool>* cancelled
+    )
+    : _normal(normal)
+    , _rhs(rhs)
+    , _size(size)
+    , _lut(lut)
+    , _cancelled(cancelled)
+    {}
+
+    virtual void multiThreadFunction(unsigned int threadIndex, unsigned int threadMax) OVERRIDE FINAL {
+        for (unsigned int c=threadIndex; c < 3; c += threadMax) {
+            solve(c);
+        }
+    }
+
+private:
+    void multiply(const std::vector<double>& x, std::vector<double>* res) {
+        auto n = _size;
+        auto normal = _normal->data();
+        for (int b=0, v=0; b < n; b++) {
+            for (int g=0; g < n; g++) {
+                for (int r=0; r < n; r++, v++, normal += 27) {
+                    double total = 0;
+                    for (int db=-1; db <= 1; db++) {
+                        if (b + db < 0 || b + db >= n) {continue;}
+                        for (int dg=-1; dg <= 1; dg++) {
+                            if (g + dg < 0 || g + dg >= n) {continue;}
+                            for (int dr=-1; dr <= 1; dr++) {
+                                if (r + dr < 0 || r + dr >= n) {continue;}
+                                auto entry = normal[_neighbourIndex(dr, dg, db)];
+                                if (entry == 0) {continue;}
+                                total += entry * x[v + (db * n + dg) * n + dr];
+                            }
+                        }
+                    }
+                    (*res)[v] = total;
+                }
+            }
+        }
+    }
+
+    void solve(int channel) {
+        auto count = _size * _size * _size;
+        std::vector<double> x(count), r(count), z(count), p(count), ap(count), invDiag(count);
+        // start from the identity
+        for (int v=0; v < count; v++) {
+            x[v] = _lut->data[v * 3 + channel];
+            auto diag = (*_normal)[v * 27 + _neighbourIndex(0, 0, 0)];
+            invDiag[v] = diag > 0 ? 1 / diag : 1;
+        }
+        multiply(x, &ap);
+        double rhsNormSq = 0;
+        for (int v=0; v < count; v++) {
+            auto b = (*_rhs)[v * 3 + channel];
+            r[v] = b - ap[v];
+            z[v] = r[v] * invDiag[v];
+            p[v] = z[v];
+            rhsNormSq += b * b;
+        }
+        double rz = 0;
+        for (int v=0; v < count; v++) {rz += r[v] * z[v];}
+        for (int i=0; i < LUT_CG_MAX_ITERATIONS; i++) {
+            if (_cancelled && *_cancelled) {return;}
+            multiply(p, &ap);
+            double pap = 0;
+            for (int v=0; v < count; v++) {pap += p[v] * ap[v];}
+            if (pap <= 0) {break;}
+            auto alpha = rz / pap;
+            double rNormSq = 0;
+            for (int v=0; v < count; v++) {
+                x[v] += alpha * p[v];
+                r[v] -= alpha * ap[v];
+                rNormSq += r[v] * r[v];
+            }
+            if (rNormSq <= LUT_CG_TOLERANCE * rhsNormSq) {break;}
+            double rzNext = 0;
+            for (int v=0; v < count; v++) {
+                z[v] = r[v] * invDiag[v];
+                rzNext += r[v] * z[v];
+            }
+            auto beta = rzNext / rz;
+            rz = rzNext;
+            for (int v=0; v < count; v++) {
+                p[v] = z[v] + beta * p[v];
+            }
+        }
+        for (int v=0; v < count; v++) {
+            _lut->data[v * 3 + channel] = x[v];
+        }
+    }
+
+    const std::vector<double>* _normal;
+    const std::vector<double>* _rhs;
+    int _size;
+    GradeLUT* _lut;
+    const std::atomic<bool>* _cancelled;
+};
+
+void fitLUT(const LUTStats& stats, double smoothness, GradeLUT* lut, const std::atomic<bool>* cancelled) {
+    auto n = stats.size;
+    auto count = n * n * n;
+    lut->resetIdentity(n);
+    if (stats.count == 0) {return;}
+
+    // scale the regularisation with the data, so smoothness means the
+    // same thing whatever the image size
+    auto dataPerVertex = stats.count / count;
+    auto lambda = smoothness * dataPerVertex;
+    auto mu = 1e-3 * dataPerVertex;
+
+    std::vector<double> normal(stats.normal);
+    std::vector<double> rhs(stats.rhs);
+    for (int b=0, v=0; b < n; b++) {
+        for (int g=0; g < n; g++) {
+            for (int r=0; r < n; r++, v++) {
+                auto vertexNormal = normal.data() + v * 27;
+                // smoothness: squared differences with each axis neighbour
+                int axes[3] = {r, g, b};
+                for (int axis=0; axis < 3; axis++) {
+                    for (int dir=-1; dir <= 1; dir += 2) {
+                        auto neighbour = axes[axis] + dir;
+                        if (neighbour < 0 || neighbour >= n) {continue;}
+                        vertexNormal[_neighbourIndex(0, 0, 0)] += lambda;
+                        vertexNormal[_neighbourIndex(
+                            axis == 0 ? dir : 0, axis == 1 ? dir : 0, axis == 2 ? dir : 0
+                        )] -= lambda;
+                    }
+                }
+                // weak pull to the identity
+                vertexNormal[_neighbourIndex(0, 0, 0)] += mu;
+                for (int c=0; c < 3; c++) {
+                    rhs[v * 3 + c] += mu * lut->data[v * 3 + c];
+                }
+            }
+        }
+    }
+
+    LUTChannelSolver solver(&normal, &rhs, n, lut, cancelled);
+    gradeMultiThread(&solver, 3);
+}
@@ -0,0 +1,87 @@
+#ifndef ESTIMATEGRADELUT_H
+#define ESTIMATEGRADELUT_H
+
+#include "ofxsImageEffect.h"
+#include "ofxsMacros.h"
+#include "ofxsMultiThread.h"
+#include "EstimateGradeGrid.h"
+#include <atomic>
+#include <string>
+#include <vector>
+
+// pixels GradeLUT::applyRow works out the tetrahedra of at once
+#define GRADELUT_BLOCK 16
+
+using namespace OFX;
+
+
+// An RGB lattice over the 0-1 cube, laid out as a .cube file:
+// red changing fastest, then green, then blue.
+class GradeLUT {
+public:
+    int size = 0;
+    std::vector<float> data;
+
+    void reset(int n);
+    void resetIdentity(int n);
+    inline int index(int r, int g, int b) const {return (b * size + g) * size + r;}
+
+    std::string serialise() const;
+    bool deserialise(const std::string& str);
+    bool writeCube(const std::string& path, const std::string& title) const;
+
+    // tetrahedral interpolation of a row of pixels.
+    // Anything after the first 3 components is copied through.
+    void applyRow(const float* srcPix, float* dstPix, int count, int components) const;
+};
+
+
+// Normal equations of the least squares fit of every lattice vertex.
+// Each sample spreads its trilinear weights over the 8 vertices of the
+// lattice cell it falls in, so a vertex only ever couples with its
+// 3x3x3 neighbourhood, which is all that's kept.
+class LUTStats {
+public:
+    int size = 0;
+    std::vector<double> normal;   // 27 per vertex
+    std::vector<double> rhs;      // 3 per vertex
+    double count = 0;
+
+    void reset(int n);
+    void merge(const LUTStats& other);
+};
+
+
+// Accumulates LUTStats from the sampled points of the intersection of
+// source and target (all of it when there are none) in one pass,
+// splitting them across threads with a set of stats each.
+class GradeLUTAccumulator : public MultiThread::Processor {
+public:
+    GradeLUTAccumulator(
+        const GradeImage* srcImg, const GradeImage* trgImg, int components, OfxRectI isect, double horizScale,
+        int size, const std::vector<OfxPointI>* points, const std::atomic<bool>* cancelled = NULL
+    );
+
+    void process(LUTStats* stats);
+
+    virtual void multiThreadFunction(unsigned int threadIndex, unsigned int threadMax) OVERRIDE FINAL;
+
+private:
+    const GradeImage* _srcImg;
+    const GradeImage* _trgImg;
+    int _components;
+    OfxRectI _isect;
+    double _horizScale;
+    int _size;
+    const std::vector<OfxPointI>* _points;
+    const std::atomic<bool>* _cancelled;
+    std::vector<LUTStats> _threadStats;
+};
+
+
+// Solves the regularised normal equations for the lattice.
+// smoothness pulls each vertex towards its neighbours, and vertices
+// without any samples nearby are held near the identity.
+void fitLUT(const LUTStats& stats, double smoothness, GradeLUT* lut, const std::atomic<bool>* cancelled = NULL);
+
+#endif // def ESTIMATEGRADELUT_H
@@ -1,6 +1,8 @@
 #include "EstimateGradePlugin.h"
 #include "ofxsCoords.h"
+#include <algorithm>
 #include <cmath>
+#include <sstream>
 #include <vector>
 #include <gsl/gsl_math.h>
 #include <gsl/gsl_multifit_nlinear.h>
@@ -36,9 +38,16 @@ EstimateGradePlugin::EstimateGradePlugin(OfxImageEffectHandle handle)
         )
     );
     _mapping = fetchChoiceParam(kParamMapping);
+    _output = fetchChoiceParam(kParamOutput);
+    _fitError = fetchStringParam(kParamFitError);
     _samples = fetchIntParam(kParamSamples);
+    _sampler = fetchChoiceParam(kParamSampler);
+    _sampleCount = fetchIntParam(kParamSampleCount);
     _iterations = fetchIntParam(kParamIterations);
+    _gridSize = fetchInt2DParam(kParamGridSize);
     _estimate = fetchPushButtonParam(kParamEstimate);
+    _cancelEstimate = fetchPushButtonParam(kParamCancelEstimate);
+    _estimateStatus = fetchStringParam(kParamEstimateStatus);
     _blackPoint = fetchRGBAParam(kParamBlackPoint);
     _whitePoint = fetchRGBAParam(kParamWhitePoint);
     _centrePoint = fetchRGBAParam(kParamCentrePoint);
@@ -56,6 +65,12 @@ EstimateGradePlugin::EstimateGradePlugin(OfxImageEffectHandle handle)
     _x3 = fetchRGBAParam(kParamX3);
     _y3 = fetchRGBAParam(kParamY3);
     _slope3 = fetchRGBAParam(kParamSlope3);
+    _cellParams = fetchStringParam(kParamCellParams);
+    _lutSize = fetchChoiceParam(kParamLUTSize);
+    _lutSmoothness = fetchDoubleParam(kParamLUTSmoothness);
+    _lutFile = fetchStringParam(kParamLUTFile);
+    _exportLUT = fetchPushButtonParam(kParamExportLUT);
+    _lutData = fetchStringParam(kParamLUTData);
 }
 
 bool EstimateGradePlugin::isIdentity(const IsIdentityArguments &args, 
@@ -336,129 +351,438 @@ void _matrixMapping(const double* srcVal, const double matrix[4][4], double* dst
     }
 }
 
-void EstimateGradePlugin::render(const RenderArguments &args)
-{
-    std::unique_ptr<Image> srcImg(_srcClip->fetchImage(args.time));
-    std::unique_ptr<Image> dstImg(_dstClip->fetchImage(args.time));
-    auto components = srcImg->getPixelComponentCount();
+void fillArrayFromRGBA(double* array, OfxRGBAColourD rgba) {
+    array[0] = rgba.r;
+    array[1] = rgba.g;
+    array[2] = rgba.b;
+    array[3] = rgba.a;
+}
 
-    auto mapping = _mapping->getValue();
+// number of fitted parameters per channel for the curve mappings
+int _curveParamCount(int mapping) {
+    return mapping == 2 ? 8 : 3;
+}
+
+// number of fitted parameters making up one cell of a GradeGrid
+int _cellParamCount(int mapping) {
+    if (mapping == 3) {return 16;}
+    return 4 * _curveParamCount(mapping);
+}
 
+// number of coefficients the render needs per cell.
+// The 3-point curve is rendered from its polynomial coefficients,
+// preceded by the x2 they switch at.
+int _renderCoeffCount(int mapping) {
     switch (mapping) {
-        case 0:
-        case 1:
         case 2:
-            renderCurve(args, mapping, srcImg.get(), dstImg.get(), components);
-            break;
+            return 4 * 9;
         case 3:
-            renderMatrix(args, srcImg.get(), dstImg.get(), components);
-            break;
+            return 16;
+        default:
+            return 4 * 3;
+    }
+}
+
+void _calcRenderCoeffs(int mapping, const double* cellParams, double* coeffs) {
+    if (mapping != 2) {
+        for (int i=0; i < _renderCoeffCount(mapping); i++) {
+            coeffs[i] = cellParams[i];
+        }
+        return;
+    }
+    for (int c=0; c < 4; c++, cellParams += 8, coeffs += 9) {
+        coeffs[0] = cellParams[3];
+        _calc3PointCurveCoeffs(
+            cellParams[0], cellParams[1], cellParams[2], cellParams[3],
+            cellParams[4], cellParams[5], cellParams[6], cellParams[7],
+            &coeffs[1], &coeffs[2], &coeffs[3], &coeffs[4],
+            &coeffs[5], &coeffs[6], &coeffs[7], &coeffs[8]
+        );
     }
 }
 
-void EstimateGradePlugin::renderCurve(const RenderArguments &args, int mapping, Image* srcImg, Image* dstImg, int components) {
-    auto blackPointRGBA = _blackPoint->getValueAtTime(args.time);
-    auto blackPoint = reinterpret_cast<double*>(&blackPointRGBA);
-    auto whitePointRGBA = _whitePoint->getValueAtTime(args.time);
-    auto whitePoint = reinterpret_cast<double*>(&whitePointRGBA);
-    auto centrePointRGBA = _centrePoint->getValueAtTime(args.time);
-    auto centrePoint = reinterpret_cast<double*>(&centrePointRGBA);
-    auto slopeRGBA = _slope->getValueAtTime(args.time);
-    auto slope = reinterpret_cast<double*>(&slopeRGBA);
-    auto gammaRGBA = _gamma->getValueAtTime(args.time);
-    auto gamma = reinterpret_cast<double*>(&gammaRGBA);
-    auto x1RGBA = _x1->getValueAtTime(args.time);
-    auto x1 = reinterpret_cast<double*>(&x1RGBA);
-    auto y1RGBA = _y1->getValueAtTime(args.time);
-    auto y1 = reinterpret_cast<double*>(&y1RGBA);
-    auto slope1RGBA = _slope1->getValueAtTime(args.time);
-    auto slope1 = reinterpret_cast<double*>(&slope1RGBA);
-    auto x2RGBA = _x2->getValueAtTime(args.time);
-    auto x2 = reinterpret_cast<double*>(&x2RGBA);
-    auto y2RGBA = _y2->getValueAtTime(args.time);
-    auto y2 = reinterpret_cast<double*>(&y2RGBA);
-    auto x3RGBA = _x3->getValueAtTime(args.time);
-    auto x3 = reinterpret_cast<double*>(&x3RGBA);
-    auto y3RGBA = _y3->getValueAtTime(args.time);
-    auto y3 = reinterpret_cast<double*>(&y3RGBA);
-    auto slope3RGBA = _slope3->getValueAtTime(args.time);
-    auto slope3 = reinterpret_cast<double*>(&slope3RGBA);
-
-    double a1[4], b1[4], c1[4], d1[4], a2[4], b2[4], c2[4], d2[4];
-
-    if (mapping == 2) {
+inline void _renderPixel(int mapping, const double* coeffs, const float* srcPix, float* dstPix, int components) {
+    if (mapping == 3) {
+        double srcVal[4];
+        double dstVal[4];
         for (int c=0; c < 4; c++) {
-            _calc3PointCurveCoeffs(
-                x1[c], y1[c], slope1[c], x2[c], y2[c], x3[c], y3[c], slope3[c],
-                &a1[c], &b1[c], &c1[c], &d1[c], &a2[c], &b2[c], &c2[c], &d2[c]
-            );
-            // std::cout << a1[c] << " " << b1[c] << " " << c1[c] << " " << d1[c] << std::endl;
-            // std::cout << a2[c] << " " << b2[c] << " " << c2[c] << " " << d2[c] << std::endl;
+            srcVal[c] = c < components ? srcPix[c] : 0;
+        }
+        _matrixMapping(srcVal, reinterpret_cast<const double(*)[4]>(coeffs), dstVal);
+        for (int c=0; c < components; c++) {
+            dstPix[c] = dstVal[c];
         }
+        return;
     }
+    for (int c=0; c < components; c++) {
+        switch (mapping) {
+            case 0:
+                dstPix[c] = _gammaMapping(srcPix[c], coeffs[c*3], coeffs[c*3 + 1], coeffs[c*3 + 2]);
+                break;
+            case 1:
+                dstPix[c] = _sCurveMapping(srcPix[c], coeffs[c*3], coeffs[c*3 + 1], coeffs[c*3 + 2]);
+                break;
+            case 2: {
+                auto curveCoeffs = coeffs + c*9;
+                dstPix[c] = _3PointCurveMapping(
+                    srcPix[c], curveCoeffs[0],
+                    curveCoeffs[1], curveCoeffs[2], curveCoeffs[3], curveCoeffs[4],
+                    curveCoeffs[5], curveCoeffs[6], curveCoeffs[7], curveCoeffs[8]
+                );
+                break;
+            }
+        }
+    }
+}
+
+// how far a graded image is from the target
+class ErrorStats {
+public:
+    double sumSq = 0;
+    double max = 0;
+    double count = 0;
+
+    void merge(const ErrorStats& other) {
+        sumSq += other.sumSq;
+        max = std::max(max, other.max);
+        count += other.count;
+    }
+    inline double rms() const {return count ? sqrt(sumSq / count) : 0;}
+};
+
+// Replaces a span of graded pixels with their absolute difference from
+// the target's, over the colour channels. Kept branch free so the loop
+// can be vectorised when the target's pixels are contiguous.
+inline void _errorSpan(
+    float* dstPix, const float* trgPix, int count, int components, int trgComponents, int channels,
+    ErrorStats* stats
+) {
+    double sumSq = 0;
+    float max = 0;
+    for (int i=0; i < count; i++, dstPix += components, trgPix += trgComponents) {
+        for (int c=0; c < channels; c++) {
+            float err = std::fabs(dstPix[c] - trgPix[c]);
+            dstPix[c] = err;
+            sumSq += err * err;
+            max = std::max(max, err);
+        }
+    }
+    stats->sumSq += sumSq;
+    stats->max = std::max(stats->max, double(max));
+    stats->count += double(count) * channels;
+}
 
-    for (int y=args.renderWindow.y1; y < args.renderWindow.y2; y++) {        
-        for (int x=args.renderWindow.x1; x < args.renderWindow.x2; x++) {
-            auto srcPix = (float*)srcImg->getPixelAddress(x, y);
-            auto dstPix = (float*)dstImg->getPixelAddress(x, y);
+// Grades the rows of window, split across threads, and given a target
+// also measures the error. Rendering works on the host's images,
+// writing to dstImg. Measuring after an estimate works on the job's
+// copies, with no dstImg, grading into a row buffer instead.
+template <class Img>
+class GradeRowProcessor : public MultiThread::Processor {
+public:
+    GradeRowProcessor(
+        int mapping, const std::vector<double>* cellCoeffs, int cols, int rows, const GradeLUT* lut,
+        Img* srcImg, Img* trgImg, Image* dstImg, int components, OfxRectI window, double horizScale
+    )
+    : _mapping(mapping)
+    , _cellCoeffs(cellCoeffs)
+    , _cols(cols)
+    , _rows(rows)
+    , _lut(lut)
+    , _srcImg(srcImg)
+    , _trgImg(trgImg)
+    , _dstImg(dstImg)
+    , _components(components)
+    , _window(window)
+    , _horizScale(horizScale)
+    {}
+
+    void setAbort(ImageEffect* effect, const std::atomic<bool>* cancelled) {
+        _effect = effect;
+        _cancelled = cancelled;
+    }
+
+    const ErrorStats& getErrorStats() const {return _stats;}
+
+    virtual void multiThreadFunction(unsigned int threadIndex, unsigned int threadMax) OVERRIDE FINAL {
+        auto width = _window.x2 - _window.x1;
+        auto height = _window.y2 - _window.y1;
+        if (width <= 0 || height <= 0) {return;}
+        auto y1 = _window.y1 + int(height * double(threadIndex) / threadMax);
+        auto y2 = _window.y1 + int(height * double(threadIndex + 1) / threadMax);
+        std::unique_ptr<GradeGridRowEvaluator> evaluator;
+        if (_mapping != 4) {
+            evaluator.reset(new GradeGridRowEvaluator(
+                _cellCoeffs, _renderCoeffCount(_mapping), _cols, _rows, _srcImg->getRegionOfDefinition()
+            ));
+        }
+        std::vector<float> rowBuffer(_dstImg ? 0 : width * _components);
+        ErrorStats stats;
+        for (auto y=y1; y < y2; y++) {
+            if (_effect && _effect->abort()) {break;}
+            if (_cancelled && *_cancelled) {break;}
+            auto srcPix = (const float*)_srcImg->getPixelAddress(_window.x1, y);
+            auto dstPix = _dstImg ? (float*)_dstImg->getPixelAddress(_window.x1, y) : rowBuffer.data();
             if (!srcPix || !dstPix) {continue;}
-            for (int c=0; c < components; c++, srcPix++, dstPix++) {
-                switch (mapping) {
-                    case 0:
-                        *dstPix = _gammaMapping(*srcPix, blackPoint[c], whitePoint[c], gamma[c]);
-                        break;
-                    case 1:
-                        *dstPix = _sCurveMapping(*srcPix, centrePoint[c], slope[c], gamma[c]);
-                        break;
-                    case 2:
-                        *dstPix = _3PointCurveMapping(
-                            *srcPix, x2[c], a1[c], b1[c], c1[c], d1[c], a2[c], b2[c], c2[c], d2[c]
-                        );
-                        break;
+            if (evaluator) {
+                evaluator->startRow(y, _window.x1);
+                for (int i=0; i < width; i++) {
+                    _renderPixel(
+                        _mapping, evaluator->next(),
+                        srcPix + i * _components, dstPix + i * _components, _components
+                    );
                 }
+            } else if (_lut && _components >= 3) {
+                _lut->applyRow(srcPix, dstPix, width, _components);
+            } else {
+                std::copy(srcPix, srcPix + width * _components, dstPix);
+            }
+            if (_trgImg) {
+                measureRow(y, dstPix, &stats);
+            }
+        }
+        std::lock_guard<std::mutex> guard(_statsLock);
+        _stats.merge(stats);
+    }
+
+private:
+    void measureRow(int y, float* dstPix, ErrorStats* stats) {
+        auto width = _window.x2 - _window.x1;
+        auto trgComponents = _trgImg->getPixelComponentCount();
+        auto channels = std::min(std::min(_components, trgComponents), 3);
+        if (_horizScale == 1) {
+            auto trgFirst = (const float*)_trgImg->getPixelAddress(_window.x1, y);
+            auto trgLast = (const float*)_trgImg->getPixelAddress(_window.x2 - 1, y);
+            if (trgFirst && trgLast) {
+                _errorSpan(dstPix, trgFirst, width, _components, trgComponents, channels, stats);
+                return;
+            }
+        }
+        for (auto x=_window.x1; x < _window.x2; x++, dstPix += _components) {
+            auto trgPix = (const float*)_trgImg->getPixelAddress(round(x / _horizScale), y);
+            if (trgPix) {
+                _errorSpan(dstPix, trgPix, 1, _components, trgComponents, channels, stats);
+            } else {
+                std::fill(dstPix, dstPix + channels, 0.f);
             }
         }
     }
+
+    int _mapping;
+    const std::vector<double>* _cellCoeffs;
+    int _cols;
+    int _rows;
+    const GradeLUT* _lut;
+    Img* _srcImg;
+    Img* _trgImg;
+    Image* _dstImg;
+    int _components;
+    OfxRectI _window;
+    double _horizScale;
+    ImageEffect* _effect = NULL;
+    const std::atomic<bool>* _cancelled = NULL;
+    ErrorStats _stats;
+    std::mutex _statsLock;
+};
+
+// everything the pixels need, per cell
+void _calcGridRenderCoeffs(const GradeGrid& grid, std::vector<double>* cellCoeffs) {
+    auto coeffCount = _renderCoeffCount(grid.mapping);
+    cellCoeffs->resize(grid.cellCount() * coeffCount);
+    for (int i=0; i < grid.cellCount(); i++) {
+        _calcRenderCoeffs(
+            grid.mapping, grid.params.data() + i * grid.cellParamCount,
+            cellCoeffs->data() + i * coeffCount
+        );
+    }
 }
 
-void fillArrayFromRGBA(double* array, OfxRGBAColourD rgba) {
-    array[0] = rgba.r;
-    array[1] = rgba.g;
-    array[2] = rgba.b;
-    array[3] = rgba.a;
+void EstimateGradePlugin::render(const RenderArguments &args)
+{
+    std::unique_ptr<Image> srcImg(_srcClip->fetchImage(args.time));
+    std::unique_ptr<Image> dstImg(_dstClip->fetchImage(args.time));
+    if (!srcImg.get() || !dstImg.get()) {return;}
+    auto components = srcImg->getPixelComponentCount();
+
+    auto mapping = _mapping->getValue();
+
+    std::unique_ptr<Image> trgImg;
+    double horizScale = 1;
+    if (_output->getValue() == 1 && _trgClip->isConnected()) {
+        trgImg.reset(_trgClip->fetchImage(args.time));
+        if (trgImg.get()) {
+            horizScale = trgImg->getPixelAspectRatio() / srcImg->getPixelAspectRatio();
+        }
+    }
+
+    GradeGrid grid;
+    std::vector<double> cellCoeffs;
+    std::shared_ptr<const GradeLUT> lut;
+    if (mapping == 4) {
+        lut = getLUT();
+    } else {
+        getGridAtTime(args.time, mapping, &grid);
+        _calcGridRenderCoeffs(grid, &cellCoeffs);
+    }
+
+    OfxRectI window;
+    Coords::rectIntersection(args.renderWindow, srcImg->getBounds(), &window);
+    GradeRowProcessor<Image> processor(
+        mapping, &cellCoeffs, grid.cols, grid.rows, lut.get(),
+        srcImg.get(), trgImg.get(), dstImg.get(), components, window, horizScale
+    );
+    processor.setAbort(this, NULL);
+    processor.multiThread();
 }
 
-void EstimateGradePlugin::renderMatrix(const RenderArguments &args, Image* srcImg, Image* dstImg, int components) {
-    double matrix[4][4];
-    fillArrayFromRGBA(matrix[0], _matrixRed->getValueAtTime(args.time));
-    fillArrayFromRGBA(matrix[1], _matrixGreen->getValueAtTime(args.time));
-    fillArrayFromRGBA(matrix[2], _matrixBlue->getValueAtTime(args.time));
-    fillArrayFromRGBA(matrix[3], _matrixAlpha->getValueAtTime(args.time));
-    for (int y=args.renderWindow.y1; y < args.renderWindow.y2; y++) {        
-        for (int x=args.renderWindow.x1; x < args.renderWindow.x2; x++) {
-            auto srcPix = (float*)srcImg->getPixelAddress(x, y);
-            auto dstPix = (float*)dstImg->getPixelAddress(x, y);
-            if (!srcPix || !dstPix) {continue;}
-            double srcVal[4];
-            double dstVal[4];
-            for (int c=0; c < 4; c++, srcPix++) {
-                if (c < components) {
-                    srcVal[c] = *srcPix;
-                } else {
-                    srcVal[c] = 0;
+std::shared_ptr<const GradeLUT> EstimateGradePlugin::getLUT() {
+    std::string lutData;
+    _lutData->getValue(lutData);
+    std::lock_guard<std::mutex> guard(_lutLock);
+    if (lutData != _lutSerialised) {
+        auto lut = std::make_shared<GradeLUT>();
+        if (lut->deserialise(lutData)) {
+            _lut = lut;
+        } else {
+            _lut.reset();
+        }
+        _lutSerialised = lutData;
+    }
+    return _lut;
+}
+
+void EstimateGradePlugin::exportLUT() {
+    std::string path;
+    _lutFile->getValue(path);
+    if (path.empty()) {
+        sendMessage(Message::eMessageError, "", "Choose a LUT File to export to");
+        return;
+    }
+    auto lut = getLUT();
+    if (!lut) {
+        sendMessage(Message::eMessageError, "", "There's no estimated 3D LUT to export");
+        return;
+    }
+    if (!lut->writeCube(path, kPluginName)) {
+        sendMessage(Message::eMessageError, "", "Could not write " + path);
+    }
+}
+
+void EstimateGradePlugin::getGridAtTime(double time, int mapping, GradeGrid* grid) {
+    auto gridSize = _gridSize->getValue();
+    if (gridSize.x > 1 || gridSize.y > 1) {
+        std::string cellParams;
+        _cellParams->getValue(cellParams);
+        if (grid->deserialise(cellParams) && grid->matches(mapping, gridSize.x, gridSize.y)) {
+            return;
+        }
+        // not estimated at this size yet, so fall back to the global params
+    }
+    grid->reset(mapping, 1, 1, _cellParamCount(mapping));
+    getCellParamsAtTime(time, mapping, grid->cell(0, 0));
+}
+
+void EstimateGradePlugin::getCellParamsAtTime(double time, int mapping, double* cellParams) {
+    switch (mapping) {
+        case 0:
+        case 1:
+        case 2: {
+            RGBAParam* params[8];
+            switch (mapping) {
+                case 0:
+                    params[0] = _blackPoint;
+                    params[1] = _whitePoint;
+                    params[2] = _gamma;
+                    break;
+                case 1:
+                    params[0] = _centrePoint;
+                    params[1] = _slope;
+                    params[2] = _gamma;
+                    break;
+                case 2:
+                    params[0] = _x1;
+                    params[1] = _y1;
+                    params[2] = _slope1;
+                    params[3] = _x2;
+                    params[4] = _y2;
+                    params[5] = _x3;
+                    params[6] = _y3;
+                    params[7] = _slope3;
+                    break;
+            }
+            auto nParams = _curveParamCount(mapping);
+            double values[4];
+            for (int i=0; i < nParams; i++) {
+                fillArrayFromRGBA(values, params[i]->getValueAtTime(time));
+                for (int c=0; c < 4; c++) {
+                    cellParams[c * nParams + i] = values[c];
+                }
+            }
+            break;
+        }
+        case 3:
+            fillArrayFromRGBA(cellParams, _matrixRed->getValueAtTime(time));
+            fillArrayFromRGBA(cellParams + 4, _matrixGreen->getValueAtTime(time));
+            fillArrayFromRGBA(cellParams + 8, _matrixBlue->getValueAtTime(time));
+            fillArrayFromRGBA(cellParams + 12, _matrixAlpha->getValueAtTime(time));
+            break;
+    }
+}
+
+void EstimateGradePlugin::setParamsFromCell(int mapping, const double* cellParams) {
+    switch (mapping) {
+        case 0:
+        case 1:
+        case 2: {
+            auto nParams = _curveParamCount(mapping);
+            double v[8][4];
+            for (int i=0; i < nParams; i++) {
+                for (int c=0; c < 4; c++) {
+                    v[i][c] = cellParams[c * nParams + i];
                 }
             }
-            _matrixMapping(srcVal, matrix, dstVal);
-            for (int c=0; c < components; c++, dstPix++) {
-                *dstPix = dstVal[c];
+            switch (mapping) {
+                case 0:
+                    _blackPoint->setValue(v[0][0], v[0][1], v[0][2], v[0][3]);
+                    _whitePoint->setValue(v[1][0], v[1][1], v[1][2], v[1][3]);
+                    _gamma->setValue(v[2][0], v[2][1], v[2][2], v[2][3]);
+                    break;
+                case 1:
+                    _centrePoint->setValue(v[0][0], v[0][1], v[0][2], v[0][3]);
+                    _slope->setValue(v[1][0], v[1][1], v[1][2], v[1][3]);
+                    _gamma->setValue(v[2][0], v[2][1], v[2][2], v[2][3]);
+                    break;
+                case 2:
+                    _x1->setValue(v[0][0], v[0][1], v[0][2], v[0][3]);
+                    _y1->setValue(v[1][0], v[1][1], v[1][2], v[1][3]);
+                    _slope1->setValue(v[2][0], v[2][1], v[2][2], v[2][3]);
+                    _x2->setValue(v[3][0], v[3][1], v[3][2], v[3][3]);
+                    _y2->setValue(v[4][0], v[4][1], v[4][2], v[4][3]);
+                    _x3->setValue(v[5][0], v[5][1], v[5][2], v[5][3]);
+                    _y3->setValue(v[6][0], v[6][1], v[6][2], v[6][3]);
+                    _slope3->setValue(v[7][0], v[7][1], v[7][2], v[7][3]);
+                    break;
             }
+            break;
         }
+        case 3:
+            // only the colour rows are estimated
+            _matrixRed->setValue(cellParams[0], cellParams[1], cellParams[2], cellParams[3]);
+            _matrixGreen->setValue(cellParams[4], cellParams[5], cellParams[6], cellParams[7]);
+            _matrixBlue->setValue(cellParams[8], cellParams[9], cellParams[10], cellParams[11]);
+            break;
     }
 }
 
 void EstimateGradePlugin::changedParam(const InstanceChangedArgs &args, const std::string &paramName) {
+    // set by checkEstimate itself
+    if (paramName == kParamEstimateStatus) {return;}
+    checkEstimate();
     if (paramName == kParamEstimate) {
         estimate(args.time);
+    } else if (paramName == kParamCancelEstimate) {
+        cancelEstimate();
+    } else if (paramName == kParamExportLUT) {
+        exportLUT();
     } else if (paramName == kParamMapping) {
         auto mapping = _mapping->getValue();
         _blackPoint->setIsSecretAndDisabled(true);
@@ -478,6 +802,12 @@ void EstimateGradePlugin::changedParam(const InstanceChangedArgs &args, const st
         _x3->setIsSecretAndDisabled(true);
         _y3->setIsSecretAndDisabled(true);
         _slope3->setIsSecretAndDisabled(true);
+        _lutSize->setIsSecretAndDisabled(true);
+        _lutSmoothness->setIsSecretAndDisabled(true);
+        _lutFile->setIsSecretAndDisabled(true);
+        _exportLUT->setIsSecretAndDisabled(true);
+        // a LUT is always estimated over the whole image
+        _gridSize->setEnabled(mapping != 4);
         switch (mapping) {
             case 0:
                 _blackPoint->setIsSecretAndDisabled(false);
@@ -505,319 +835,395 @@ void EstimateGradePlugin::changedParam(const InstanceChangedArgs &args, const st
                 _matrixBlue->setIsSecretAndDisabled(false);
                 _matrixAlpha->setIsSecretAndDisabled(false);
                 break;
+            case 4:
+                _lutSize->setIsSecretAndDisabled(false);
+                _lutSmoothness->setIsSecretAndDisabled(false);
+                _lutFile->setIsSecretAndDisabled(false);
+                _exportLUT->setIsSecretAndDisabled(false);
+                break;
         }
     }
 }
 
-void EstimateGradePlugin::estimate(double time) {
-    progressStart("Estimating");
-    progressUpdate(0);
-    std::unique_ptr<Image> srcImg(_srcClip->fetchImage(time));
-    progressUpdate(0.1);
-    std::unique_ptr<Image> trgImg(_trgClip->fetchImage(time));
-    progressUpdate(0.2);
-    auto srcROD = srcImg->getRegionOfDefinition();
-    auto trgROD = trgImg->getRegionOfDefinition();
-    auto horizScale = trgImg->getPixelAspectRatio() / srcImg->getPixelAspectRatio();
-    trgROD.x1 *= horizScale;
-    trgROD.x2 *= horizScale;
-
-    OfxRectI isect;
-    Coords::rectIntersection(srcROD, trgROD, &isect);
-
-    auto components = srcImg->getPixelComponentCount();
+void EstimateGradePlugin::changedClip(const InstanceChangedArgs &/*args*/, const std::string &/*clipName*/) {
+    checkEstimate();
+}
 
-    auto mapping = _mapping->getValue();
-    auto samples = _samples->getValue();
-    auto iterations = _iterations->getValue();
+void EstimateGradePlugin::syncPrivateData() {
+    checkEstimate();
+}
 
+// where each curve mapping starts fitting from,
+// and what a channel gets if there's nothing to fit to
+void _curveStart(int mapping, double* start) {
     switch (mapping) {
         case 0:
+            start[0] = 0.0;
+            start[1] = 1.0;
+            start[2] = 1.0;
+            break;
         case 1:
-        case 2:
-            estimateCurve(time, mapping, samples, iterations, srcImg.get(), trgImg.get(), components, isect, horizScale);
+            start[0] = 0.5;
+            start[1] = 1.0;
+            start[2] = 1.0;
             break;
-        case 3:
-            estimateMatrix(time, samples, iterations, srcImg.get(), trgImg.get(), components, isect, horizScale);
+        case 2:
+            start[0] = 0.0;
+            start[1] = 0.0;
+            start[2] = 1.0;
+            start[3] = 0.5;
+            start[4] = 0.5;
+            start[5] = 1.0;
+            start[6] = 1.0;
+            start[7] = 1.0;
             break;
     }
-
-    progressEnd();
 }
 
-void EstimateGradePlugin::estimateCurve(
-    double time, int mapping, int samples, int iterations, Image* srcImg, Image* trgImg, int components, OfxRectI isect, double horizScale
+void _estimateCurve(
+    int mapping, int samples, int iterations, const CellStats& stats, int components, double* cellParams
 ) {
-    std::vector<std::vector<OfxPointD>> sums(components);
-    std::vector<std::vector<int>> counts(components);
+    auto nParams = _curveParamCount(mapping);
 
-    for (int c=0; c < components; c++) {
-        sums[c].resize(samples);
-        counts[c].resize(samples);
-        for (int i=0; i < samples; i++) {
-            sums[c][i] = {0, 0};
-            counts[c][i] = 0;
-        }
-    }
+    const gsl_multifit_nlinear_type * T = gsl_multifit_nlinear_trust;
 
-    for (auto y=isect.y1; y < isect.y2; y++) {        
-        for (auto x=isect.x1; x < isect.x2; x++) {
-            auto srcPix = (float*)srcImg->getPixelAddress(x, y);
-            auto trgPix = (float*)trgImg->getPixelAddress(round(x / horizScale), y);
-            if (!srcPix || !trgPix) {continue;}
-            for (int c=0; c < components; c++, srcPix++, trgPix++) {
-                if (*srcPix < 0 || *srcPix >= 1) {continue;}
-                int i = floor(*srcPix * samples);
-                sums[c][i].x += *srcPix;
-                sums[c][i].y += *trgPix;
-                counts[c][i]++;
-            }
-        }
-    }
+    std::vector<OfxPointD> srcAndTrg;
+    std::vector<double> weights;
 
-    std::vector<std::vector<OfxPointD>> srcAndTrgs(components);
+    for (int c=0; c < 4; c++) {
+        auto channelParams = cellParams + c * nParams;
+        _curveStart(mapping, channelParams);
+        if (c >= components) {continue;}
 
-    for (int c=0; c < components; c++) {
-        auto srcAndTrgPtr = &srcAndTrgs[c];
+        srcAndTrg.clear();
         for (int i=0; i < samples; i++) {
-            auto count = counts[c][i];
+            auto count = stats.binCounts[c * samples + i];
             if (!count) {continue;}
-            auto sum = sums[c][i];
-            srcAndTrgPtr->push_back({sum.x / count, sum.y / count});
-        }
-        printf("for %d: %ld points\n", c, srcAndTrgPtr->size());
-    }
-
-
-    const gsl_multifit_nlinear_type * T = gsl_multifit_nlinear_trust;
-
-    double blackPoint[4];
-    double whitePoint[4];
-    double centrePoint[4];
-    double slope[4];
-    double gamma[4];
-    double x1[4], y1[4], slope1[4], x2[4], y2[4], x3[4], y3[4], slope3[4];
-
-    int nParams = 3;
-    if (mapping == 2) {nParams = 8;}
-
-    for (int c=0; c < components; c++) {
-        auto srcAndTrgPtr = &(srcAndTrgs[c]);
-        printf("count %d: %ld\n", c, srcAndTrgPtr->size());
-        if (srcAndTrgPtr->size() < 3) {
-            printf("TOO SMALL!\n");
-            continue;
+            auto sum = stats.binSums[c * samples + i];
+            srcAndTrg.push_back({sum.x / count, sum.y / count});
         }
+        if (srcAndTrg.size() < size_t(nParams)) {continue;}
 
         gsl_multifit_nlinear_parameters fdfParams = gsl_multifit_nlinear_default_parameters();
-        gsl_multifit_nlinear_workspace * w = gsl_multifit_nlinear_alloc(T, &fdfParams, srcAndTrgPtr->size(), nParams);
+        gsl_multifit_nlinear_workspace * w = gsl_multifit_nlinear_alloc(T, &fdfParams, srcAndTrg.size(), nParams);
         gsl_multifit_nlinear_fdf fdf;
+        fdf.fvv = nullptr;
 
-        std::unique_ptr<double> start(new double[nParams]);
         switch (mapping) {
             case 0:
                 fdf.f = &_gammaMappingFunction;
                 fdf.df = &_gammaMappingDerivative;
                 fdf.df = nullptr;
-                start.get()[0] = 0.0;
-                start.get()[1] = 1.0;
-                start.get()[2] = 1.0;
                 break;
             case 1:
                 fdf.f = &_sCurveMappingFunction;
                 fdf.df = &_sCurveMappingDerivative;
-                start.get()[0] = 0.5;
-                start.get()[1] = 1.0;
-                start.get()[2] = 1.0;
                 break;
             case 2:
                 fdf.f = &_3PointCurveMappingFunction;
                 fdf.df = nullptr;
-                start.get()[0] = 0.0;
-                start.get()[1] = 0.0;
-                start.get()[2] = 1.0;
-                start.get()[3] = 0.5;
-                start.get()[4] = 0.5;
-                start.get()[5] = 1.0;
-                start.get()[6] = 1.0;
-                start.get()[7] = 1.0;
                 break;
         }
 
-        fdf.n = srcAndTrgPtr->size();
+        fdf.n = srcAndTrg.size();
         fdf.p = nParams;
-        fdf.params = srcAndTrgPtr;
-        
-        gsl_vector_view startView = gsl_vector_view_array(start.get(), nParams);
-        std::unique_ptr<double> weights(new double[srcAndTrgPtr->size()]);
-        for (int i=0; i < srcAndTrgPtr->size(); i++) {weights.get()[i] = 1;}
-        gsl_vector_view weightsView = gsl_vector_view_array(weights.get(), srcAndTrgPtr->size());
+        fdf.params = &srcAndTrg;
+
+        gsl_vector_view startView = gsl_vector_view_array(channelParams, nParams);
+        weights.assign(srcAndTrg.size(), 1);
+        gsl_vector_view weightsView = gsl_vector_view_array(weights.data(), weights.size());
 
         gsl_multifit_nlinear_winit(&startView.vector, &weightsView.vector, &fdf, w);
 
         int info;
-        auto status = gsl_multifit_nlinear_driver(iterations, 1e-8, 1e-8, 1e-8, NULL, NULL, &info, w);
+        gsl_multifit_nlinear_driver(iterations, 1e-8, 1e-8, 1e-8, NULL, NULL, &info, w);
 
-        switch (mapping) {
-            case 0:
-                blackPoint[c] = gsl_vector_get(w->x, 0);
-                whitePoint[c] = gsl_vector_get(w->x, 1);
-                gamma[c] = gsl_vector_get(w->x, 2);
-                break;
-            case 1:
-                centrePoint[c] = gsl_vector_get(w->x, 0);
-                slope[c] = gsl_vector_get(w->x, 1);
-                gamma[c] = gsl_vector_get(w->x, 2);
-                break;
-            case 2:
-                x1[c] = gsl_vector_get(w->x, 0);
-                y1[c] = gsl_vector_get(w->x, 1);
-                slope1[c] = gsl_vector_get(w->x, 2);
-                x2[c] = gsl_vector_get(w->x, 3);
-                y2[c] = gsl_vector_get(w->x, 4);
-                x3[c] = gsl_vector_get(w->x, 5);
-                y3[c] = gsl_vector_get(w->x, 6);
-                slope3[c] = gsl_vector_get(w->x, 7);
-                break;
+        for (int i=0; i < nParams; i++) {
+            channelParams[i] = gsl_vector_get(w->x, i);
         }
 
-        // printf("done %d: %d. %f %f %f\n", c, status, gsl_vector_get(w->x, 0), gsl_vector_get(w->x, 1), gsl_vector_get(w->x, 2));
-
         gsl_multifit_nlinear_free(w);
     }
-
-    switch (mapping) {
-        case 0:
-            _blackPoint->setValue(blackPoint[0], blackPoint[1], blackPoint[2], blackPoint[3]);
-            _whitePoint->setValue(whitePoint[0], whitePoint[1], whitePoint[2], whitePoint[3]);
-            _gamma->setValue(gamma[0], gamma[1], gamma[2], gamma[3]);
-            break;
-        case 1:
-            _centrePoint->setValue(centrePoint[0], centrePoint[1], centrePoint[2], centrePoint[3]);
-            _slope->setValue(slope[0], slope[1], slope[2], slope[3]);
-            _gamma->setValue(gamma[0], gamma[1], gamma[2], gamma[3]);
-            break;
-        case 2:
-            _x1->setValue(x1[0], x1[1], x1[2], x1[3]);
-            _y1->setValue(y1[0], y1[1], y1[2], y1[3]);
-            _slope1->setValue(slope1[0], slope1[1], slope1[2], slope1[3]);
-            _x2->setValue(x2[0], x2[1], x2[2], x2[3]);
-            _y2->setValue(y2[0], y2[1], y2[2], y2[3]);
-            _x3->setValue(x3[0], x3[1], x3[2], x3[3]);
-            _y3->setValue(y3[0], y3[1], y3[2], y3[3]);
-            _slope3->setValue(slope3[0], slope3[1], slope3[2], slope3[3]);
-            break;
-    }
 }
 
-void EstimateGradePlugin::estimateMatrix(
-    double time, int samples, int iterations, Image* srcImg, Image* trgImg, int components, OfxRectI isect, double horizScale
-) {
-    std::vector<std::unique_ptr<double>> srcVals;
-    std::vector<std::unique_ptr<double>> trgVals;
-    for (auto y=isect.y1; y < isect.y2; y+=100) {        
-        for (auto x=isect.x1; x < isect.x2; x+=100) {
-            auto srcPix = (float*)srcImg->getPixelAddress(x, y);
-            auto trgPix = (float*)trgImg->getPixelAddress(round(x / horizScale), y);
-            if (!srcPix || !trgPix) {continue;}
-            double* srcVal = new double[4];
-            double* trgVal = new double[4];
-            bool skip = false;
-            for (int c=0; c < 4; c++, srcPix++, trgPix++) {
-                if (c < components) {
-                    if (std::isnan(*srcPix) || std::isnan(*trgPix)) {
-                        std::cout << "nan detected" << x << "," << y << ";" << c << std::endl;
-                        skip = true;
-                        break;
-                    }
-                    srcVal[c] = *srcPix;
-                    trgVal[c] = *trgPix;
-                } else {
-                    srcVal[c] = 0;
-                    trgVal[c] = 0;
-                }
-            }
-            if (skip) {continue;}
-            srcVals.push_back(std::unique_ptr<double>(srcVal));
-            trgVals.push_back(std::unique_ptr<double>(trgVal));
+void _estimateMatrix(const CellStats& stats, double* cellParams) {
+    // identity to begin with. Alpha is left alone.
+    for (int r=0; r < 4; r++) {
+        for (int c=0; c < 4; c++) {
+            cellParams[r * 4 + c] = r == c ? 1 : 0;
         }
     }
+    if (stats.matrixCount < 3) {return;}
+
+    // M = (T S^T)(S S^T)^-1
+    double srcSq[9];
+    double trgSrc[9];
+    double res[9];
+    for (int r=0; r < 3; r++) {
+        for (int c=0; c < 3; c++) {
+            srcSq[r * 3 + c] = stats.srcSq[r][c];
+            trgSrc[r * 3 + c] = stats.trgSrc[r][c];
+        }
+    }
+    gsl_matrix_view srcSqMat = gsl_matrix_view_array(srcSq, 3, 3);
+    gsl_matrix_view trgSrcMat = gsl_matrix_view_array(trgSrc, 3, 3);
+    gsl_matrix_view resMat = gsl_matrix_view_array(res, 3, 3);
+
+    int signum;
+    gsl_permutation* perm = gsl_permutation_alloc(3);
+    gsl_linalg_LU_decomp(&srcSqMat.matrix, perm, &signum);
 
-    gsl_matrix *srcMat = gsl_matrix_alloc(3, srcVals.size());
-    gsl_matrix *trgMat = gsl_matrix_alloc(3, srcVals.size());
+    gsl_matrix *srcSqInvMat = gsl_matrix_alloc(3, 3);
+    gsl_linalg_LU_invert(&srcSqMat.matrix, perm, srcSqInvMat);
 
-    for (int c=0; c < 3; c++) {
-        for (int i=0; i < srcVals.size(); i++) {
-            gsl_matrix_set(srcMat, c, i, srcVals[i].get()[c]);
-            gsl_matrix_set(trgMat, c, i, trgVals[i].get()[c]);
+    gsl_blas_dgemm(CblasNoTrans, CblasNoTrans, 1, &trgSrcMat.matrix, srcSqInvMat, 0, &resMat.matrix);
+
+    gsl_permutation_free(perm);
+    gsl_matrix_free(srcSqInvMat);
+
+    for (int r=0; r < 3; r++) {
+        for (int c=0; c < 3; c++) {
+            if (!std::isfinite(res[r * 3 + c])) {return;}
         }
     }
+    for (int r=0; r < 3; r++) {
+        for (int c=0; c < 3; c++) {
+            cellParams[r * 4 + c] = res[r * 3 + c];
+        }
+    }
+}
 
-    progressUpdate(0.4);
+// Fits every cell of the grid from its stats, sharing the cells out across threads.
+class GradeCellFitter : public MultiThread::Processor {
+public:
+    GradeCellFitter(
+        int mapping, int samples, int iterations, int components,
+        const std::vector<CellStats>* cells, GradeGrid* grid, const std::atomic<bool>* cancelled
+    )
+    : _mapping(mapping)
+    , _samples(samples)
+    , _iterations(iterations)
+    , _components(components)
+    , _cells(cells)
+    , _grid(grid)
+    , _cancelled(cancelled)
+    {}
+
+    virtual void multiThreadFunction(unsigned int threadIndex, unsigned int threadMax) OVERRIDE FINAL {
+        for (int i=threadIndex; i < _grid->cellCount(); i += threadMax) {
+            if (*_cancelled) {return;}
+            auto cellParams = _grid->params.data() + i * _grid->cellParamCount;
+            if (_mapping == 3) {
+                _estimateMatrix((*_cells)[i], cellParams);
+            } else {
+                _estimateCurve(_mapping, _samples, _iterations, (*_cells)[i], _components, cellParams);
+            }
+        }
+    }
 
-    gsl_matrix *srcTransMat = gsl_matrix_alloc(srcMat->size2, srcMat->size1);
-    gsl_matrix_transpose_memcpy(srcTransMat, srcMat);
+private:
+    int _mapping;
+    int _samples;
+    int _iterations;
+    int _components;
+    const std::vector<CellStats>* _cells;
+    GradeGrid* _grid;
+    const std::atomic<bool>* _cancelled;
+};
+
+EstimateGradeJob::~EstimateGradeJob() {
+    cancel();
+    wait();
+}
 
-    gsl_matrix *srcSqMat = gsl_matrix_alloc(srcMat->size1, srcMat->size1);
-    gsl_blas_dgemm(CblasNoTrans, CblasNoTrans, 1, srcMat, srcTransMat, 0, srcSqMat);
+void EstimateGradeJob::start() {
+    _thread = std::thread(&EstimateGradeJob::run, this);
+}
 
-    progressUpdate(0.5);
+void EstimateGradeJob::cancel() {
+    _cancelled = true;
+}
 
-    int signum;
-    gsl_permutation* perm = gsl_permutation_alloc(srcMat->size1);
-    gsl_linalg_LU_decomp(srcSqMat, perm, &signum);
+void EstimateGradeJob::wait() {
+    if (_thread.joinable()) {
+        _thread.join();
+    }
+}
 
-    progressUpdate(0.6);
+bool EstimateGradeJob::matches(const EstimateGradeJob& other) const {
+    if (
+        mapping != other.mapping || time != other.time
+        || sampler != other.sampler || sampleCount != other.sampleCount
+    ) {return false;}
+    if (mapping == 4) {
+        return lutSize == other.lutSize && lutSmoothness == other.lutSmoothness;
+    }
+    return (
+        samples == other.samples && iterations == other.iterations
+        && gridSize.x == other.gridSize.x && gridSize.y == other.gridSize.y
+    );
+}
 
-    gsl_matrix *srcSqInvMat = gsl_matrix_alloc(srcSqMat->size1, srcSqMat->size1);
-    gsl_linalg_LU_invert(srcSqMat, perm, srcSqInvMat);
+void EstimateGradeJob::run() {
+    std::vector<OfxPointI> points;
+    createGradeSampler(sampler)->sample(srcImg, isect, sampleCount, &points, &_cancelled);
+    _progress = 0.1;
+    if (mapping == 4) {
+        LUTStats stats;
+        GradeLUTAccumulator(
+            &srcImg, &trgImg, components, isect, horizScale, lutSize, &points, &_cancelled
+        ).process(&stats);
+        _progress = 0.5;
+        if (!_cancelled) {
+            fitLUT(stats, lutSmoothness, &lut, &_cancelled);
+        }
+    } else {
+        std::vector<CellStats> cells;
+        GradeStatsAccumulator(
+            &srcImg, &trgImg, components, isect, horizScale,
+            mapping == 3, samples, gridSize.x, gridSize.y, &points, &_cancelled
+        ).process(&cells);
+        _progress = 0.4;
+        grid.reset(mapping, gridSize.x, gridSize.y, _cellParamCount(mapping));
+        if (!_cancelled) {
+            GradeCellFitter fitter(mapping, samples, iterations, components, &cells, &grid, &_cancelled);
+            gradeMultiThread(&fitter, std::min(gradeThreadCount(), unsigned(grid.cellCount())));
+        }
+    }
+    _progress = 0.9;
+    if (!_cancelled) {
+        measure();
+    }
+    _progress = 1;
+    _finished = true;
+}
 
-    progressUpdate(0.7);
+// grades the copy of the source with the results,
+// and measures how far that is from the target
+void EstimateGradeJob::measure() {
+    std::vector<double> cellCoeffs;
+    if (mapping != 4) {
+        _calcGridRenderCoeffs(grid, &cellCoeffs);
+    }
+    OfxRectI window;
+    Coords::rectIntersection(isect, srcImg.bounds, &window);
+    GradeRowProcessor<const GradeImage> processor(
+        mapping, &cellCoeffs, grid.cols, grid.rows, &lut,
+        &srcImg, &trgImg, NULL, components, window, horizScale
+    );
+    processor.setAbort(NULL, &_cancelled);
+    gradeMultiThread(&processor, std::min(gradeThreadCount(), unsigned(std::max(1, window.y2 - window.y1))));
+    rmsError = processor.getErrorStats().rms();
+    maxError = processor.getErrorStats().max;
+}
 
-    gsl_matrix *trgSrcMat = gsl_matrix_alloc(srcMat->size1, srcMat->size1);
-    gsl_blas_dgemm(CblasNoTrans, CblasNoTrans, 1, trgMat, srcTransMat, 0, trgSrcMat);
+void EstimateGradePlugin::estimate(double time) {
+    std::unique_ptr<EstimateGradeJob> job(new EstimateGradeJob());
+    job->mapping = _mapping->getValue();
+    job->samples = _samples->getValue();
+    job->sampler = _sampler->getValue();
+    job->sampleCount = _sampleCount->getValue();
+    job->iterations = _iterations->getValue();
+    job->time = time;
+    job->gridSize = _gridSize->getValue();
+    job->gridSize.x = std::max(1, job->gridSize.x);
+    job->gridSize.y = std::max(1, job->gridSize.y);
+    job->lutSize = _lutSize->getValue() == 0 ? 17 : 33;
+    job->lutSmoothness = _lutSmoothness->getValue();
+
+    // pressing again while the same estimate is running changes nothing,
+    // otherwise the newest settings replace whatever's running
+    if (_job) {
+        if (_job->matches(*job)) {return;}
+        dropEstimate();
+    }
 
-    progressUpdate(0.8);
+    std::unique_ptr<Image> srcImg(_srcClip->fetchImage(time));
+    std::unique_ptr<Image> trgImg(_trgClip->fetchImage(time));
+    if (!srcImg.get() || !trgImg.get()) {
+        setEstimateStatus("Needs both Source and Target");
+        return;
+    }
+    auto srcROD = srcImg->getRegionOfDefinition();
+    auto trgROD = trgImg->getRegionOfDefinition();
+    job->horizScale = trgImg->getPixelAspectRatio() / srcImg->getPixelAspectRatio();
+    trgROD.x1 *= job->horizScale;
+    trgROD.x2 *= job->horizScale;
+    Coords::rectIntersection(srcROD, trgROD, &job->isect);
+
+    job->components = srcImg->getPixelComponentCount();
+    if (job->mapping == 4 && job->components < 3) {
+        setEstimateStatus("A 3D LUT needs RGB");
+        return;
+    }
 
-    gsl_matrix *resMat = gsl_matrix_alloc(srcMat->size1, srcMat->size1);
-    gsl_blas_dgemm(CblasNoTrans, CblasNoTrans, 1, trgSrcMat, srcSqInvMat, 0, resMat);
+    // the host's images and params are only touched from here,
+    // the job works on its own copies
+    job->srcImg.copy(srcImg.get());
+    job->trgImg.copy(trgImg.get());
+    srcImg.reset();
+    trgImg.reset();
 
-    progressUpdate(0.9);
+    _job = std::move(job);
+    _job->start();
+    setEstimateStatus(kEstimatingStatus " 0" kEstimatingStatusSuffix);
+}
 
-    std::cout << "M = ";
-    for (size_t i = 0; i < resMat->size1; ++i) {
-        OfxRGBAColourD col;
-        for (size_t j = 0; j < resMat->size2; ++j) {
-            auto val = gsl_matrix_get(resMat, i, j);
-            std::cout << val << " ";
-            std::cout.flush();
-            switch (j) {
-                case 0: col.r = val; break;
-                case 1: col.g = val; break;
-                case 2: col.b = val; break;
-                case 3: col.a = val; break;
-            }
-        }
-        switch (i) {
-            case 0:
-                _matrixRed->setValue(col.r, col.g, col.b, col.a); break;
-            case 1:
-                _matrixGreen->setValue(col.r, col.g, col.b, col.a); break;
-            case 2:
-                _matrixBlue->setValue(col.r, col.g, col.b, col.a); break;
-            case 3:
-                _matrixAlpha->setValue(col.r, col.g, col.b, col.a); break;
-        }
-        std::cout << std::endl;
+void EstimateGradePlugin::cancelEstimate() {
+    if (!_job) {return;}
+    dropEstimate();
+    setEstimateStatus("Cancelled");
+}
+
+void EstimateGradePlugin::dropEstimate() {
+    // joining it here could hold up the host's UI
+    // until a long solve notices it's been cancelled
+    _job->cancel();
+    _cancelledJobs.push_back(std::move(_job));
+}
+
+void EstimateGradePlugin::checkEstimate() {
+    _cancelledJobs.erase(
+        std::remove_if(
+            _cancelledJobs.begin(), _cancelledJobs.end(),
+            [](const std::unique_ptr<EstimateGradeJob>& job) {return job->isFinished();}
+        ),
+        _cancelledJobs.end()
+    );
+    if (!_job) {return;}
+    if (!_job->isFinished()) {
+        setEstimateStatus(
+            kEstimatingStatus " " + std::to_string(int(_job->getProgress() * 100))
+            + kEstimatingStatusSuffix
+        );
+        return;
     }
+    // let go of it before setting anything,
+    // as that comes back round through changedParam
+    auto job = std::move(_job);
+    job->wait();
+    if (job->isCancelled()) {
+        setEstimateStatus("Cancelled");
+        return;
+    }
+    if (job->mapping == 4) {
+        _lutData->setValue(job->lut.serialise());
+    } else if (job->grid.cellCount() == 1) {
+        setParamsFromCell(job->mapping, job->grid.cell(0, 0));
+    } else {
+        _cellParams->setValue(job->grid.serialise());
+    }
+    std::ostringstream fitError;
+    fitError.precision(4);
+    fitError << "RMS " << job->rmsError << ", Max " << job->maxError;
+    _fitError->setValue(fitError.str());
+    setEstimateStatus("Done");
+}
 
-    // Free memory
-    gsl_matrix_free(srcMat);
-    gsl_matrix_free(trgMat);
-    gsl_matrix_free(srcTransMat);
-    gsl_matrix_free(srcSqMat);
-    gsl_permutation_free(perm);
-    gsl_matrix_free(srcSqInvMat);
-    gsl_matrix_free(trgSrcMat);
-    gsl_matrix_free(resMat);
+void EstimateGradePlugin::setEstimateStatus(const std::string& status) {
+    std::string current;
+    _estimateStatus->getValue(current);
+    if (current != status) {
+        _estimateStatus->setValue(status);
+    }
 }
@@ -1,6 +1,13 @@
 #include "ofxsImageEffect.h"
 #include "ofxsMacros.h"
+#include "EstimateGradeGrid.h"
+#include "EstimateGradeLUT.h"
+#include "EstimateGradeSampler.h"
+#include <atomic>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
 
 using namespace OFX;
 
@@ -20,18 +27,66 @@ using namespace OFX;
 #define kParamMappingLabel "Mapping"
 #define kParamMappingHint "Mapping"
 
+#define kParamOutput "output"
+#define kParamOutputLabel "Output"
+#define kParamOutputHint "Graded shows the source with the estimated grade applied. Error shows how far that is from the target, per channel"
+
+#define kParamFitError "fitError"
+#define kParamFitErrorLabel "Fit Error"
+#define kParamFitErrorHint "RMS and maximum difference between the graded source and the target, measured over the whole image when an estimate finishes"
+
 #define kParamSamples "samples"
 #define kParamSamplesLabel "Samples"
 #define kParamSamplesHint "Samples"
 
+#define kParamSampler "sampler"
+#define kParamSamplerLabel "Sampler"
+#define kParamSamplerHint "How the pixels to estimate from are picked. Stratified takes one at random from each cell of a grid, Poisson Disc takes random ones spread evenly apart, Luminance Balanced takes the same number from each band of brightness"
+
+#define kParamSampleCount "sampleCount"
+#define kParamSampleCountLabel "Sample Count"
+#define kParamSampleCountHint "Roughly how many pixels to estimate from"
+
 #define kParamIterations "iterations"
 #define kParamIterationsLabel "Iterations"
 #define kParamIterationsHint "Iterations"
 
+#define kParamGridSize "gridSize"
+#define kParamGridSizeLabel "Grid Size"
+#define kParamGridSizeHint "Columns and rows of cells to estimate the mapping in. 1x1 estimates one mapping for the whole image"
+
+#define kParamLUTSize "lutSize"
+#define kParamLUTSizeLabel "LUT Size"
+#define kParamLUTSizeHint "Number of lattice points along each axis of the 3D LUT"
+
+#define kParamLUTSmoothness "lutSmoothness"
+#define kParamLUTSmoothnessLabel "LUT Smoothness"
+#define kParamLUTSmoothnessHint "How strongly each lattice point is pulled towards its neighbours when fitting the 3D LUT"
+
+#define kParamLUTFile "lutFile"
+#define kParamLUTFileLabel "LUT File"
+#define kParamLUTFileHint "Where to export the 3D LUT as a .cube file"
+
+#define kParamExportLUT "exportLUT"
+#define kParamExportLUTLabel "Export LUT"
+#define kParamExportLUTHint "Export LUT"
+
 #define kParamEstimate "estimate"
 #define kParamEstimateLabel "Estimate"
 #define kParamEstimateHint "Estimate"
 
+#define kParamCancelEstimate "cancelEstimate"
+#define kParamCancelEstimateLabel "Cancel Estimate"
+#define kParamCancelEstimateHint "Stop the estimate that's running, leaving the parameters as they were"
+
+#define kParamEstimateStatus "estimateStatus"
+#define kParamEstimateStatusLabel "Status"
+#define kParamEstimateStatusHint "Progress of the estimate. Hosts don't give the plugin a way to check on it by itself, so this, and the results once it's done, only update when something on the node is changed or clicked"
+
+// what the status shows while estimating, before and after the progress
+#define kEstimatingStatus "Estimating"
+#define kEstimatingStatusSuffix "% (updates on any change to the node)"
+
 #define kParamBlackPoint "blackPoint"
 #define kParamBlackPointLabel "Black Point"
 #define kParamBlackPointHint "Black Point"
@@ -84,6 +139,60 @@ using namespace OFX;
 
 #define kParamSlope3 "slope3"
 
+#define kParamCellParams "cellParams"
+
+#define kParamLUTData "lutData"
+
+
+// One run of the estimation, on a thread of its own.
+// Everything it needs is copied in before it starts, so that the host's
+// images and params are only touched on the main thread. The results are
+// left in grid or lut for the plugin to set once it's finished.
+class EstimateGradeJob
+{
+public:
+    int mapping;
+    int samples;
+    int sampler;
+    int sampleCount;
+    int iterations;
+    double time;
+    OfxPointI gridSize;
+    int lutSize;
+    double lutSmoothness;
+    GradeImage srcImg;
+    GradeImage trgImg;
+    OfxRectI isect;
+    double horizScale;
+    int components;
+
+    GradeGrid grid;
+    GradeLUT lut;
+    double rmsError = 0;
+    double maxError = 0;
+
+    ~EstimateGradeJob();
+
+    void start();
+    void cancel();
+    void wait();
+    inline bool isFinished() const {return _finished;}
+    inline bool isCancelled() const {return _cancelled;}
+    inline double getProgress() const {return _progress;}
+
+    // whether the settings would give the same results
+    bool matches(const EstimateGradeJob& other) const;
+
+private:
+    void run();
+    void measure();
+
+    std::thread _thread;
+    std::atomic<bool> _cancelled {false};
+    std::atomic<bool> _finished {false};
+    std::atomic<double> _progress {0};
+};
+
 
 class EstimateGradePlugin : public ImageEffect
 {
@@ -94,8 +203,11 @@ private:
     /* Override the render */
     virtual void render(const OFX::RenderArguments &args) OVERRIDE FINAL;
 
-    void renderCurve(const RenderArguments &args, int mapping, Image* srcImg, Image* dstImg, int components);
-    void renderMatrix(const RenderArguments &args, Image* srcImg, Image* dstImg, int components);
+    void getGridAtTime(double time, int mapping, GradeGrid* grid);
+    void getCellParamsAtTime(double time, int mapping, double* cellParams);
+    void setParamsFromCell(int mapping, const double* cellParams);
+    std::shared_ptr<const GradeLUT> getLUT();
+    void exportLUT();
     
     virtual bool isIdentity(const IsIdentityArguments &args, Clip * &identityClip, double &identityTime
 #ifdef OFX_EXTENSIONS_NUKE
@@ -105,11 +217,19 @@ private:
     ) OVERRIDE FINAL;
 
     virtual void changedParam(const InstanceChangedArgs &args, const std::string &paramName);
+    virtual void changedClip(const InstanceChangedArgs &args, const std::string &clipName) OVERRIDE FINAL;
+    virtual void syncPrivateData() OVERRIDE FINAL;
 
     virtual void estimate(double time);
-
-    void estimateCurve(double time, int mapping, int samples, int iterations, Image* srcImg, Image* trgImg, int components, OfxRectI isect, double horizScale);
-    void estimateMatrix(double time, int samples, int iterations, Image* srcImg, Image* trgImg, int components, OfxRectI isect, double horizScale);
+    void cancelEstimate();
+    // sets the results of a finished estimate, or shows how far it's got.
+    // Only called from actions, as params can't be set from the job's thread,
+    // and OFX gives no idle or timer action to call it from when the job
+    // finishes, so the results wait for the next action.
+    void checkEstimate();
+    // cancels the running job, leaving it to finish in the background
+    void dropEstimate();
+    void setEstimateStatus(const std::string& status);
 
 
 private:
@@ -117,9 +237,16 @@ private:
     Clip* _trgClip;
     Clip* _dstClip;
     ChoiceParam* _mapping;
+    ChoiceParam* _output;
+    StringParam* _fitError;
     IntParam* _samples;
+    ChoiceParam* _sampler;
+    IntParam* _sampleCount;
     IntParam* _iterations;
+    Int2DParam* _gridSize;
     PushButtonParam* _estimate;
+    PushButtonParam* _cancelEstimate;
+    StringParam* _estimateStatus;
     RGBAParam* _whitePoint;
     RGBAParam* _blackPoint;
     RGBAParam* _centrePoint;
@@ -137,4 +264,19 @@ private:
     RGBAParam* _x3;
     RGBAParam* _y3;
     RGBAParam* _slope3;
+    StringParam* _cellParams;
+    ChoiceParam* _lutSize;
+    DoubleParam* _lutSmoothness;
+    StringParam* _lutFile;
+    PushButtonParam* _exportLUT;
+    StringParam* _lutData;
+
+    // parsed from _lutData, only when it changes
+    std::shared_ptr<const GradeLUT> _lut;
+    std::string _lutSerialised;
+    std::mutex _lutLock;
+
+    std::unique_ptr<EstimateGradeJob> _job;
+    // cancelled jobs, let go of once they've wound down
+    std::vector<std::unique_ptr<EstimateGradeJob>> _cancelledJobs;
 };
@@ -65,6 +65,18 @@ void EstimateGradePluginFactory::describeInContext(ImageEffectDescriptor &desc,
         param->appendOption("S-Curve");
         param->appendOption("3-Point-Curve");
         param->appendOption("Matrix");
+        param->appendOption("3D LUT");
+        param->setAnimates(false);
+        if (page) {
+            page->addChild(*param);
+        }
+    }
+    {
+        auto param = desc.defineChoiceParam(kParamOutput);
+        param->setLabel(kParamOutputLabel);
+        param->setHint(kParamOutputHint);
+        param->appendOption("Graded");
+        param->appendOption("Error");
         param->setAnimates(false);
         if (page) {
             page->addChild(*param);
@@ -79,6 +91,31 @@ void EstimateGradePluginFactory::describeInContext(ImageEffectDescriptor &desc,
             page->addChild(*param);
         }
     }
+    {
+        auto param = desc.defineChoiceParam(kParamSampler);
+        param->setLabel(kParamSamplerLabel);
+        param->setHint(kParamSamplerHint);
+        param->appendOption("Stratified");
+        param->appendOption("Poisson Disc");
+        param->appendOption("Luminance Balanced");
+        param->appendOption("Every Pixel");
+        param->setAnimates(false);
+        if (page) {
+            page->addChild(*param);
+        }
+    }
+    {
+        auto param = desc.defineIntParam(kParamSampleCount);
+        param->setLabel(kParamSampleCountLabel);
+        param->setHint(kParamSampleCountHint);
+        param->setDefault(100000);
+        param->setRange(1, 100000000);
+        param->setDisplayRange(1000, 1000000);
+        param->setAnimates(false);
+        if (page) {
+            page->addChild(*param);
+        }
+    }
     {
         auto param = desc.defineIntParam(kParamIterations);
         param->setLabel(kParamIterationsLabel);
@@ -88,6 +125,43 @@ void EstimateGradePluginFactory::describeInContext(ImageEffectDescriptor &desc,
             page->addChild(*param);
         }
     }
+    {
+        auto param = desc.defineInt2DParam(kParamGridSize);
+        param->setLabel(kParamGridSizeLabel);
+        param->setHint(kParamGridSizeHint);
+        param->setDefault(1, 1);
+        param->setRange(1, 1, 64, 64);
+        param->setDisplayRange(1, 1, 16, 16);
+        param->setAnimates(false);
+        if (page) {
+            page->addChild(*param);
+        }
+    }
+    {
+        auto param = desc.defineChoiceParam(kParamLUTSize);
+        param->setLabel(kParamLUTSizeLabel);
+        param->setHint(kParamLUTSizeHint);
+        param->appendOption("17");
+        param->appendOption("33");
+        param->setAnimates(false);
+        param->setIsSecretAndDisabled(true);
+        if (page) {
+            page->addChild(*param);
+        }
+    }
+    {
+        auto param = desc.defineDoubleParam(kParamLUTSmoothness);
+        param->setLabel(kParamLUTSmoothnessLabel);
+        param->setHint(kParamLUTSmoothnessHint);
+        param->setDefault(0.01);
+        param->setRange(0, 1000);
+        param->setDisplayRange(0, 1);
+        param->setAnimates(false);
+        param->setIsSecretAndDisabled(true);
+        if (page) {
+            page->addChild(*param);
+        }
+    }
     {
         auto param = desc.definePushButtonParam(kParamEstimate);
         param->setLabel(kParamEstimateLabel);
@@ -96,6 +170,60 @@ void EstimateGradePluginFactory::describeInContext(ImageEffectDescriptor &desc,
             page->addChild(*param);
         }
     }
+    {
+        auto param = desc.definePushButtonParam(kParamCancelEstimate);
+        param->setLabel(kParamCancelEstimateLabel);
+        param->setHint(kParamCancelEstimateHint);
+        if (page) {
+            page->addChild(*param);
+        }
+    }
+    {
+        auto param = desc.defineStringParam(kParamEstimateStatus);
+        param->setLabel(kParamEstimateStatusLabel);
+        param->setHint(kParamEstimateStatusHint);
+        param->setStringType(eStringTypeLabel);
+        param->setDefault("");
+        param->setAnimates(false);
+        param->setEvaluateOnChange(false);
+        param->setIsPersistent(false);
+        if (page) {
+            page->addChild(*param);
+        }
+    }
+    {
+        auto param = desc.defineStringParam(kParamFitError);
+        param->setLabel(kParamFitErrorLabel);
+        param->setHint(kParamFitErrorHint);
+        param->setStringType(eStringTypeLabel);
+        param->setDefault("");
+        param->setAnimates(false);
+        param->setEvaluateOnChange(false);
+        if (page) {
+            page->addChild(*param);
+        }
+    }
+    {
+        auto param = desc.defineStringParam(kParamLUTFile);
+        param->setLabel(kParamLUTFileLabel);
+        param->setHint(kParamLUTFileHint);
+        param->setStringType(eStringTypeFilePath);
+        param->setFilePathExists(false);
+        param->setAnimates(false);
+        param->setIsSecretAndDisabled(true);
+        if (page) {
+            page->addChild(*param);
+        }
+    }
+    {
+        auto param = desc.definePushButtonParam(kParamExportLUT);
+        param->setLabel(kParamExportLUTLabel);
+        param->setHint(kParamExportLUTHint);
+        param->setIsSecretAndDisabled(true);
+        if (page) {
+            page->addChild(*param);
+        }
+    }
     {
         auto param = desc.defineRGBAParam(kParamBlackPoint);
         param->setLabel(kParamBlackPointLabel);
@@ -247,6 +375,26 @@ void EstimateGradePluginFactory::describeInContext(ImageEffectDescriptor &desc,
             page->addChild(*param);
         }
     }
+    {
+        // the estimated 3D LUT
+        auto param = desc.defineStringParam(kParamLUTData);
+        param->setDefault("");
+        param->setAnimates(false);
+        param->setIsSecretAndDisabled(true);
+        if (page) {
+            page->addChild(*param);
+        }
+    }
+    {
+        // per cell parameters when estimating over a grid
+        auto param = desc.defineStringParam(kParamCellParams);
+        param->setDefault("");
+        param->setAnimates(false);
+        param->setIsSecretAndDisabled(true);
+        if (page) {
+            page->addChild(*param);
+        }
+    }
 }
 
 ImageEffect* EstimateGradePluginFactory::createInstance(OfxImageEffectHandle handle, ContextEnum /*context*/)
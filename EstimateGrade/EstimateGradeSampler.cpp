@@ -0,0 +1,232 @@
+#include "EstimateGradeSampler.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <random>
+
+#define SAMPLER_SEED 1
+#define POISSON_DISC_ATTEMPTS 30
+// Bridson's algorithm covers about this much of the area per r squared
+#define POISSON_DISC_DENSITY 0.63
+#define LUMINANCE_BANDS 32
+
+
+inline double _luminance(const float* pix, int components) {
+    if (components < 3) {return pix[0];}
+    return 0.2126 * pix[0] + 0.7152 * pix[1] + 0.0722 * pix[2];
+}
+
+inline double _area(OfxRectI isect) {
+    return double(std::max(0, isect.x2 - isect.x1)) * std::max(0, isect.y2 - isect.y1);
+}
+
+// StratifiedSampler
+
+void StratifiedSampler::sample(
+    const GradeImage& /*srcImg*/, OfxRectI isect, int count,
+    std::vector<OfxPointI>* points, const std::atomic<bool>* cancelled
+) {
+    points->clear();
+    auto area = _area(isect);
+    if (area <= 0 || count >= area) {return;}
+    auto width = isect.x2 - isect.x1;
+    auto height = isect.y2 - isect.y1;
+    auto cellSize = sqrt(area / std::max(1, count));
+    auto cols = std::max(1, std::min(width, int(round(width / cellSize))));
+    auto rows = std::max(1, std::min(height, int(round(height / cellSize))));
+    std::mt19937 rng(SAMPLER_SEED);
+    points->reserve(cols * rows);
+    for (int row=0; row < rows; row++) {
+        if (cancelled && *cancelled) {return;}
+        auto y1 = isect.y1 + int(double(height) * row / rows);
+        auto y2 = isect.y1 + int(double(height) * (row + 1) / rows);
+        for (int col=0; col < cols; col++) {
+            auto x1 = isect.x1 + int(double(width) * col / cols);
+            auto x2 = isect.x1 + int(double(width) * (col + 1) / cols);
+            points->push_back({
+                std::uniform_int_distribution<int>(x1, x2 - 1)(rng),
+                std::uniform_int_distribution<int>(y1, y2 - 1)(rng)
+            });
+        }
+    }
+}
+
+// PoissonDiscSampler
+
+void PoissonDiscSampler::sample(
+    const GradeImage& /*srcImg*/, OfxRectI isect, int count,
+    std::vector<OfxPointI>* points, const std::atomic<bool>* cancelled
+) {
+    points->clear();
+    auto area = _area(isect);
+    if (area <= 0) {return;}
+    auto radius = sqrt(POISSON_DISC_DENSITY * area / std::max(1, count));
+    if (radius < 1) {return;}
+    auto width = isect.x2 - isect.x1;
+    auto height = isect.y2 - isect.y1;
+
+    // background grid small enough to hold at most one point per cell
+    auto cellSize = radius / M_SQRT2;
+    auto gridCols = int(ceil(width / cellSize));
+    auto gridRows = int(ceil(height / cellSize));
+    std::vector<int> grid(size_t(gridCols) * gridRows, -1);
+    std::vector<OfxPointD> found;
+    std::vector<int> active;
+
+    std::mt19937 rng(SAMPLER_SEED);
+    std::uniform_real_distribution<double> unit(0, 1);
+    auto add = [&](OfxPointD p) {
+        auto col = int(p.x / cellSize);
+        auto row = int(p.y / cellSize);
+        grid[row * gridCols + col] = found.size();
+        active.push_back(found.size());
+        found.push_back(p);
+    };
+    auto isFree = [&](OfxPointD p) {
+        auto col = int(p.x / cellSize);
+        auto row = int(p.y / cellSize);
+        for (int r=std::max(0, row - 2); r <= std::min(gridRows - 1, row + 2); r++) {
+            for (int c=std::max(0, col - 2); c <= std::min(gridCols - 1, col + 2); c++) {
+                auto i = grid[r * gridCols + c];
+                if (i < 0) {continue;}
+                auto dx = found[i].x - p.x;
+                auto dy = found[i].y - p.y;
+                if (dx * dx + dy * dy < radius * radius) {return false;}
+            }
+        }
+        return true;
+    };
+
+    add({unit(rng) * width, unit(rng) * height});
+    while (!active.empty()) {
+        if (cancelled && *cancelled) {return;}
+        auto activeIndex = std::uniform_int_distribution<size_t>(0, active.size() - 1)(rng);
+        auto centre = found[active[activeIndex]];
+        bool added = false;
+        for (int k=0; k < POISSON_DISC_ATTEMPTS; k++) {
+            auto angle = unit(rng) * 2 * M_PI;
+            auto dist = radius * (1 + unit(rng));
+            OfxPointD p = {centre.x + dist * cos(angle), centre.y + dist * sin(angle)};
+            if (p.x < 0 || p.x >= width || p.y < 0 || p.y >= height) {continue;}
+            if (!isFree(p)) {continue;}
+            add(p);
+            added = true;
+            break;
+        }
+        if (!added) {
+            active[activeIndex] = active.back();
+            active.pop_back();
+        }
+    }
+
+    points->reserve(found.size());
+    for (auto& p : found) {
+        points->push_back({isect.x1 + int(p.x), isect.y1 + int(p.y)});
+    }
+    // row order, to be kinder to the cache when accumulating
+    std::sort(points->begin(), points->end(), [](const OfxPointI& a, const OfxPointI& b) {
+        return a.y < b.y || (a.y == b.y && a.x < b.x);
+    });
+}
+
+// LuminanceBalancedSampler
+
+void LuminanceBalancedSampler::sample(
+    const GradeImage& srcImg, OfxRectI isect, int count,
+    std::vector<OfxPointI>* points, const std::atomic<bool>* cancelled
+) {
+    points->clear();
+    auto area = _area(isect);
+    if (area <= 0 || count >= area) {return;}
+    auto components = srcImg.getPixelComponentCount();
+
+    auto minLum = std::numeric_limits<double>::infinity();
+    auto maxLum = -minLum;
+    for (auto y=isect.y1; y < isect.y2; y++) {
+        if (cancelled && *cancelled) {return;}
+        for (auto x=isect.x1; x < isect.x2; x++) {
+            auto srcPix = srcImg.getPixelAddress(x, y);
+            if (!srcPix) {continue;}
+            auto lum = _luminance(srcPix, components);
+            if (std::isnan(lum)) {continue;}
+            minLum = std::min(minLum, lum);
+            maxLum = std::max(maxLum, lum);
+        }
+    }
+    if (!(maxLum >= minLum)) {return;}
+    auto bandScale = maxLum > minLum ? LUMINANCE_BANDS / (maxLum - minLum) : 0;
+    auto band = [&](const float* srcPix) {
+        auto lum = _luminance(srcPix, components);
+        if (std::isnan(lum)) {return -1;}
+        return std::min(LUMINANCE_BANDS - 1, int((lum - minLum) * bandScale));
+    };
+
+    double bandCounts[LUMINANCE_BANDS] = {};
+    for (auto y=isect.y1; y < isect.y2; y++) {
+        if (cancelled && *cancelled) {return;}
+        for (auto x=isect.x1; x < isect.x2; x++) {
+            auto srcPix = srcImg.getPixelAddress(x, y);
+            if (!srcPix) {continue;}
+            auto b = band(srcPix);
+            if (b >= 0) {bandCounts[b]++;}
+        }
+    }
+
+    // share count out evenly, smallest bands first,
+    // so what they can't use goes to the bigger ones
+    int order[LUMINANCE_BANDS];
+    for (int b=0; b < LUMINANCE_BANDS; b++) {
+        order[b] = b;
+    }
+    std::sort(order, order + LUMINANCE_BANDS, [&](int a, int b) {
+        return bandCounts[a] < bandCounts[b];
+    });
+    double quotas[LUMINANCE_BANDS];
+    double remaining = count;
+    for (int i=0; i < LUMINANCE_BANDS; i++) {
+        auto b = order[i];
+        quotas[b] = std::min(bandCounts[b], floor(remaining / (LUMINANCE_BANDS - i)));
+        remaining -= quotas[b];
+    }
+
+    // selection sampling gives exactly each band's quota in one pass
+    std::mt19937 rng(SAMPLER_SEED);
+    std::uniform_real_distribution<double> unit(0, 1);
+    points->reserve(count);
+    for (auto y=isect.y1; y < isect.y2; y++) {
+        if (cancelled && *cancelled) {return;}
+        for (auto x=isect.x1; x < isect.x2; x++) {
+            auto srcPix = srcImg.getPixelAddress(x, y);
+            if (!srcPix) {continue;}
+            auto b = band(srcPix);
+            if (b < 0) {continue;}
+            if (unit(rng) * bandCounts[b] < quotas[b]) {
+                points->push_back({x, y});
+                quotas[b]--;
+            }
+            bandCounts[b]--;
+        }
+    }
+}
+
+// EveryPixelSampler
+
+void EveryPixelSampler::sample(
+    const GradeImage& /*srcImg*/, OfxRectI /*isect*/, int /*count*/,
+    std::vector<OfxPointI>* points, const std::atomic<bool>* /*cancelled*/
+) {
+    points->clear();
+}
+
+std::unique_ptr<GradeSampler> createGradeSampler(int method) {
+    switch (method) {
+        case 1:
+            return std::unique_ptr<GradeSampler>(new PoissonDiscSampler());
+        case 2:
+            return std::unique_ptr<GradeSampler>(new LuminanceBalancedSampler());
+        case 3:
+            return std::unique_ptr<GradeSampler>(new EveryPixelSampler());
+        default:
+            return std::unique_ptr<GradeSampler>(new StratifiedSampler());
+    }
+}
@@ -0,0 +1,110 @@
+#ifndef ESTIMATEGRADESAMPLER_H
+#define ESTIMATEGRADESAMPLER_H
+
+#include "EstimateGradeGrid.h"
+#include <atomic>
+#include <memory>
+#include <vector>
+
+using namespace OFX;
+
+
+// Picks which pixels of the source an estimate looks at.
+// Samplers are seeded, so the same settings always pick the same pixels.
+class GradeSampler {
+public:
+    virtual ~GradeSampler() {}
+
+    // fills points with roughly count positions inside isect.
+    // Leaves points empty when every pixel should be used.
+    virtual void sample(
+        const GradeImage& srcImg, OfxRectI isect, int count,
+        std::vector<OfxPointI>* points, const std::atomic<bool>* cancelled
+    ) = 0;
+};
+
+
+// One random pixel from each cell of a grid of about count cells.
+class StratifiedSampler : public GradeSampler {
+public:
+    virtual void sample(
+        const GradeImage& srcImg, OfxRectI isect, int count,
+        std::vector<OfxPointI>* points, const std::atomic<bool>* cancelled
+    ) OVERRIDE FINAL;
+};
+
+
+// Random pixels no closer to each other than a radius chosen to give
+// about count of them (Bridson's algorithm).
+class PoissonDiscSampler : public GradeSampler {
+public:
+    virtual void sample(
+        const GradeImage& srcImg, OfxRectI isect, int count,
+        std::vector<OfxPointI>* points, const std::atomic<bool>* cancelled
+    ) OVERRIDE FINAL;
+};
+
+
+// Splits the source's luminance range into bands and takes the same number
+// of random pixels from each, so large flat areas don't swamp the fit.
+// Bands with too few pixels give their share to the others.
+class LuminanceBalancedSampler : public GradeSampler {
+public:
+    virtual void sample(
+        const GradeImage& srcImg, OfxRectI isect, int count,
+        std::vector<OfxPointI>* points, const std::atomic<bool>* cancelled
+    ) OVERRIDE FINAL;
+};
+
+
+// Every pixel, as estimates used to.
+class EveryPixelSampler : public GradeSampler {
+public:
+    virtual void sample(
+        const GradeImage& srcImg, OfxRectI isect, int count,
+        std::vector<OfxPointI>* points, const std::atomic<bool>* cancelled
+    ) OVERRIDE FINAL;
+};
+
+
+// 0 Stratified, 1 Poisson Disc, 2 Luminance Balanced, 3 Every Pixel
+std::unique_ptr<GradeSampler> createGradeSampler(int method);
+
+
+// Calls f(x, y) for this thread's share of the samples: a range of points,
+// or of the rows of isect when points is empty.
+template <class F>
+void forEachThreadSample(
+    const std::vector<OfxPointI>& points, OfxRectI isect,
+    unsigned int threadIndex, unsigned int threadMax,
+    const std::atomic<bool>* cancelled, F f
+) {
+    if (points.empty()) {
+        auto height = isect.y2 - isect.y1;
+        auto y1 = isect.y1 + int(height * double(threadIndex) / threadMax);
+        auto y2 = isect.y1 + int(height * double(threadIndex + 1) / threadMax);
+        for (auto y=y1; y < y2; y++) {
+            if (cancelled && *cancelled) {return;}
+            for (auto x=isect.x1; x < isect.x2; x++) {
+                f(x, y);
+            }
+        }
+        return;
+    }
+    auto i1 = size_t(points.size() * double(threadIndex) / threadMax);
+    auto i2 = size_t(points.size() * double(threadIndex + 1) / threadMax);
+    for (auto i=i1; i < i2; i++) {
+        if (cancelled && (i - i1) % 4096 == 0 && *cancelled) {return;}
+        f(points[i].x, points[i].y);
+    }
+}
+
+// how many threads it's worth sharing the samples between
+inline unsigned int sampleThreadLimit(const std::vector<OfxPointI>& points, OfxRectI isect) {
+    if (points.empty()) {
+        return unsigned(std::max(1, isect.y2 - isect.y1));
+    }
+    return unsigned(std::max(size_t(1), points.size() / 1024));
+}
+
+#endif // def ESTIMATEGRADESAMPLER_H
@@ -0,0 +1,117 @@
+#include "OffsetMapCache.h"
+#include <algorithm>
+
+
+// CachedOutput
+
+size_t CachedOutput::bytes() const {
+    return (
+        size_t(std::max(0, rod.x2 - rod.x1)) * std::max(0, rod.y2 - rod.y1)
+        * components * sizeof(float)
+    );
+}
+
+float* CachedOutput::lock() {
+    _lockCount++;
+    return (float*)imgMem->lock();
+}
+
+void CachedOutput::unlock() {
+    imgMem->unlock();
+    _lockCount--;
+}
+
+// OffsetMapCache
+
+void OffsetMapCache::setBudget(size_t budget) {
+    _budget = budget;
+    _makeRoom(0);
+}
+
+CachedOutput* OffsetMapCache::find(double t, OfxPointD renderScale) {
+    auto iter = _outputByKey.find(_key(t, renderScale));
+    if (iter == _outputByKey.end()) {return NULL;}
+    _outputs.splice(_outputs.begin(), _outputs, iter->second);
+    return &*iter->second;
+}
+
+CachedOutput* OffsetMapCache::insert(
+    double t, OfxPointD renderScale, OfxRectI rod, int components, bool isCheckpoint
+) {
+    auto key = _key(t, renderScale);
+    auto iter = _outputByKey.find(key);
+    if (iter != _outputByKey.end()) {
+        auto replaced = iter->second;
+        if (replaced->isLocked()) {
+            // still being read, so it's only unlisted for now, as the
+            // first to go once it's unlocked
+            replaced->isCheckpoint = false;
+            _outputs.splice(_outputs.end(), _outputs, replaced);
+            _outputByKey.erase(iter);
+        } else {
+            _erase(replaced);
+        }
+    }
+    _outputs.emplace_front();
+    auto& output = _outputs.front();
+    output.time = t;
+    output.renderScale = renderScale;
+    output.rod = rod;
+    output.components = components;
+    output.isCheckpoint = isCheckpoint;
+    auto bytes = output.bytes();
+    // room for it, without it being the first to go
+    _outputByKey[key] = _outputs.begin();
+    output._lockCount++;
+    _makeRoom(bytes);
+    output._lockCount--;
+    output.imgMem.reset(new ImageMemory(bytes));
+    _bytes += bytes;
+    return &output;
+}
+
+void OffsetMapCache::erase(CachedOutput* output) {
+    auto iter = _outputByKey.find(_key(output->time, output->renderScale));
+    if (iter == _outputByKey.end() || &*iter->second != output) {return;}
+    _erase(iter->second);
+}
+
+void OffsetMapCache::clear() {
+    auto iter = _outputs.begin();
+    while (iter != _outputs.end()) {
+        auto next = std::next(iter);
+        if (!iter->isLocked()) {
+            _erase(iter);
+        }
+        iter = next;
+    }
+}
+
+OffsetMapCache::Key OffsetMapCache::_key(double t, OfxPointD renderScale) {
+    return Key(t, renderScale.x, renderScale.y);
+}
+
+void OffsetMapCache::_makeRoom(size_t bytes) {
+    // least recently used first, checkpoints only if that's not enough
+    for (auto checkpoints : {false, true}) {
+        auto iter = _outputs.end();
+        while (_bytes + bytes > _budget && iter != _outputs.begin()) {
+            --iter;
+            if (iter->isLocked() || iter->isCheckpoint != checkpoints) {continue;}
+            auto dropped = iter++;
+            _erase(dropped);
+        }
+    }
+}
+
+void OffsetMapCache::_erase(Iterator iter) {
+    if (iter->imgMem.get()) {
+        _bytes -= iter->bytes();
+    }
+    // a replaced output isn't what's listed under its key any more
+    auto keyIter = _outputByKey.find(_key(iter->time, iter->renderScale));
+    if (keyIter != _outputByKey.end() && keyIter->second == iter) {
+        _outputByKey.erase(keyIter);
+    }
+    _outputs.erase(iter);
+}
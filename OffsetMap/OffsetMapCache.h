@@ -0,0 +1,74 @@
+#ifndef OFFSETMAPCACHE_H
+#define OFFSETMAPCACHE_H
+
+#include "ofxsImageEffect.h"
+#include <list>
+#include <map>
+#include <tuple>
+
+using namespace OFX;
+
+
+// An output kept between renders, its pixels packed over its rod.
+class CachedOutput {
+public:
+    double time;
+    OfxPointD renderScale;
+    OfxRectI rod;
+    int components;
+    // kept over other outputs when there isn't room for everything
+    bool isCheckpoint;
+    auto_ptr<ImageMemory> imgMem;
+
+    size_t bytes() const;
+
+    // the cache won't drop it until it's unlocked
+    float* lock();
+    void unlock();
+    bool isLocked() const {return _lockCount > 0;}
+
+private:
+    friend class OffsetMapCache;
+    int _lockCount = 0;
+};
+
+
+// Outputs by time and render scale, up to a budget of bytes.
+// Making room drops the least recently used, leaving checkpoints until
+// there's nothing else to drop, and never dropping locked outputs.
+class OffsetMapCache {
+public:
+    void setBudget(size_t budget);
+
+    // the output for t at renderScale, now the most recently used,
+    // or NULL if it's not cached
+    CachedOutput* find(double t, OfxPointD renderScale);
+
+    // a new output with memory for rod and components, replacing any
+    // for the same t and render scale. A locked one it replaces is
+    // kept until it's unlocked, then dropped before anything else
+    CachedOutput* insert(
+        double t, OfxPointD renderScale, OfxRectI rod, int components, bool isCheckpoint
+    );
+
+    // drops output, e.g. when it didn't get finished
+    void erase(CachedOutput* output);
+
+    void clear();
+
+private:
+    typedef std::tuple<double, double, double> Key;
+    typedef std::list<CachedOutput>::iterator Iterator;
+
+    static Key _key(double t, OfxPointD renderScale);
+    void _makeRoom(size_t bytes);
+    void _erase(Iterator iter);
+
+    // most recently used first
+    std::list<CachedOutput> _outputs;
+    std::map<Key, Iterator> _outputByKey;
+    size_t _budget = 0;
+    size_t _bytes = 0;
+};
+
+#endif // def OFFSETMAPCACHE_H
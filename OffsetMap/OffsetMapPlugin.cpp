@@ -16,6 +16,8 @@ OffsetMapPlugin::OffsetMapPlugin(OfxImageEffectHandle handle)
     	    _dstClip->getPixelComponents() == ePixelComponentRGBA));
     _iterateTemporally = fetchBooleanParam(kParamIterateTemporally);
     _referenceFrame = fetchIntParam(kParamReferenceFrame);
+    _cacheSize = fetchIntParam(kParamCacheSize);
+    _checkpointInterval = fetchIntParam(kParamCheckpointInterval);
 }
 
 void OffsetMapPlugin::getClipPreferences(ClipPreferencesSetter &clipPreferences) {
@@ -23,7 +25,6 @@ void OffsetMapPlugin::getClipPreferences(ClipPreferencesSetter &clipPreferences)
 }
 
 void OffsetMapPlugin::getFramesNeeded(const FramesNeededArguments &args, FramesNeededSetter &frames) {
-    std::cout << "getFramesNeeded " << args.time << std::endl;
     auto iterTemp = _iterateTemporally->getValueAtTime(args.time);
     auto refFrame = _referenceFrame->getValueAtTime(args.time);
     if (!iterTemp || refFrame == args.time) {
@@ -51,35 +52,30 @@ bool OffsetMapPlugin::isIdentity(const IsIdentityArguments &args,
 // the overridden render function
 void OffsetMapPlugin::render(const RenderArguments &args)
 {
+    // the same render again means something's changed upstream,
+    // a different render scale is just cached separately
     if (_haveLastRenderArgs) {
         if (
-            args.renderScale.x != _lastRenderArgs.renderScale.x
-            || args.renderScale.y != _lastRenderArgs.renderScale.y
-            || (
-                args.time == _lastRenderArgs.time
-                && args.renderWindow.x1 == _lastRenderArgs.renderWindow.x1
-                && args.renderWindow.y1 == _lastRenderArgs.renderWindow.y1
-                && args.renderWindow.x2 == _lastRenderArgs.renderWindow.x2
-                && args.renderWindow.y2 == _lastRenderArgs.renderWindow.y2
-            )
+            args.time == _lastRenderArgs.time
+            && args.renderScale.x == _lastRenderArgs.renderScale.x
+            && args.renderScale.y == _lastRenderArgs.renderScale.y
+            && args.renderWindow.x1 == _lastRenderArgs.renderWindow.x1
+            && args.renderWindow.y1 == _lastRenderArgs.renderWindow.y1
+            && args.renderWindow.x2 == _lastRenderArgs.renderWindow.x2
+            && args.renderWindow.y2 == _lastRenderArgs.renderWindow.y2
         ) {
-            std::cout << "clearing cache" << std::endl;
-            for (auto i : _cachedOutputByTime) {
-                i.second->inCache = false;
-                i.second->imgMem.reset();
-            }
-            _cachedOutputByTime.clear();
+            _cache.clear();
         }
     }
     _haveLastRenderArgs = true;
     _lastRenderArgs = args;
-    std::cout << "calling getOutput for " << args.time << std::endl;
+    _cache.setBudget(size_t(std::max(0, _cacheSize->getValueAtTime(args.time))) << 20);
     auto output = getOutput(args.time, args.renderScale);
     if (!output) {return;}
     auto width = output->rod.x2 - output->rod.x1;
     auto_ptr<Image> dstImg(_dstClip->fetchImage(args.time));
     auto dstComponents = dstImg->getPixelComponentCount();
-    auto imgData = (float*)output->imgMem->lock();
+    auto imgData = output->lock();
     for (int y=args.renderWindow.y1; y < args.renderWindow.y2; y++) {        
         auto dstPix = (float*)dstImg->getPixelAddress(args.renderWindow.x1, y);
         for (int x=args.renderWindow.x1; x < args.renderWindow.x2; x++) {
@@ -93,70 +89,109 @@ void OffsetMapPlugin::render(const RenderArguments &args)
             }
         }
     }
-    output->imgMem->unlock();
+    output->unlock();
 }
 
 CachedOutput* OffsetMapPlugin::getOutput(double t, OfxPointD renderScale)
 {
-    for (auto i : _cachedOutputByTime) {
-        std::cout << i.first << " ";
+    auto cached = _cache.find(t, renderScale);
+    if (cached) {return cached;}
+
+    auto iterTemp = _iterateTemporally->getValueAtTime(t);
+    auto refFrame = _referenceFrame->getValueAtTime(t);
+    if (!iterTemp || refFrame == t) {
+        return getOutputFromSource(t, renderScale, true, NULL);
+    }
+
+    // Back to the nearest frame with a cached output, or the reference
+    // frame, then forward a frame at a time, each from the last.
+    // Frames between checkpoints only need to last until the next one's
+    // drawn, so two working outputs take turns holding them.
+    auto step = refFrame < t ? 1 : -1;
+    auto frame = t;
+    int steps = 0;
+    CachedOutput* prev = NULL;
+    while (!prev) {
+        frame -= step;
+        steps++;
+        prev = _cache.find(frame, renderScale);
+        if (!prev && (frame - refFrame) * step <= 0) {break;}
+    }
+    CachedOutput working[2];
+    if (!prev) {
+        prev = getOutputFromSource(frame, renderScale, isCheckpoint(frame), &working[0]);
+        if (!prev) {return NULL;}
     }
-    std::cout << std::endl;
-    auto iter = _cachedOutputByTime.find(t);
-    if (iter != _cachedOutputByTime.end()) {
-        std::cout << "using cached " << t << std::endl;
-        return iter->second;
+    while (steps > 0) {
+        frame += step;
+        steps--;
+        auto spare = prev == &working[0] ? &working[1] : &working[0];
+        auto srcData = prev->lock();
+        auto output = drawOutput(
+            frame, renderScale, srcData, prev->rod, prev->components,
+            steps == 0 || isCheckpoint(frame), spare
+        );
+        prev->unlock();
+        if (!output) {return NULL;}
+        prev = output;
     }
+    return prev;
+}
+
+CachedOutput* OffsetMapPlugin::getOutputFromSource(
+    double t, OfxPointD renderScale, bool keep, CachedOutput* working
+) {
+    auto_ptr<Image> srcImg(_srcClip->fetchImage(t, _srcClip->getRegionOfDefinition(t)));
+    if (!srcImg.get()) {return NULL;}
+    return drawOutput(
+        t, renderScale, (float*)srcImg->getPixelData(), srcImg->getRegionOfDefinition(),
+        srcImg->getPixelComponentCount(), keep, working
+    );
+}
+
+bool OffsetMapPlugin::isCheckpoint(double t) {
+    if (!_iterateTemporally->getValueAtTime(t)) {return false;}
+    auto refFrame = _referenceFrame->getValueAtTime(t);
+    auto interval = _checkpointInterval->getValueAtTime(t);
+    return interval > 0 && fmod(fabs(t - refFrame), interval) == 0;
+}
 
-    std::cout << "caching " << t << std::endl;
+CachedOutput* OffsetMapPlugin::drawOutput(
+    double t, OfxPointD renderScale,
+    const float* srcImgData, OfxRectI srcROD, int srcComponents,
+    bool keep, CachedOutput* working
+) {
     auto_ptr<Image> offImg(_offClip->fetchImage(t, _offClip->getRegionOfDefinition(t)));
     if (!offImg.get()) {return NULL;}
     auto offROD = offImg->getRegionOfDefinition();
     auto offComponents = offImg->getPixelComponentCount();
-    float* srcImgData;
-    OfxRectI srcROD;
-    int srcComponents;
-    CachedOutput* srcImgCached = NULL;
-    auto_ptr<Image> srcImgCleaner;
-    auto iterTemp = _iterateTemporally->getValueAtTime(t);
-    auto refFrame = _referenceFrame->getValueAtTime(t);        
-    if (iterTemp && refFrame != t) {
-        auto srcFrame = t + (refFrame < t ? -1 : 1);
-        srcImgCached = getOutput(srcFrame, renderScale);
-        if (!srcImgCached) {
-            return NULL;
-        }
-        srcComponents = srcImgCached->components;
-        srcImgData = (float*)srcImgCached->imgMem->lock();
-        srcROD = srcImgCached->rod;
-    } else {
-        srcImgCleaner.reset(
-            _srcClip->fetchImage(
-                t, _srcClip->getRegionOfDefinition(t)
-            )
-        );
-        srcComponents = srcImgCleaner->getPixelComponentCount();
-        srcImgData = (float*)srcImgCleaner->getPixelData();
-        srcROD = srcImgCleaner->getRegionOfDefinition();
-    }
     auto srcWidth = srcROD.x2 - srcROD.x1;
-    auto ret = _cachedOutputs + _nextCacheIndex;
-    if (ret->inCache) {
-        _cachedOutputByTime.erase(ret->time);
+    CachedOutput* ret;
+    if (keep) {
+        ret = _cache.insert(t, renderScale, offROD, srcComponents, isCheckpoint(t));
+    } else {
+        // only reallocated when the size changes
+        auto bytes = working->imgMem.get() ? working->bytes() : 0;
+        ret = working;
+        ret->time = t;
+        ret->renderScale = renderScale;
+        ret->rod = offROD;
+        ret->components = srcComponents;
+        ret->isCheckpoint = false;
+        if (ret->bytes() != bytes) {
+            ret->imgMem.reset();
+            ret->imgMem.reset(new ImageMemory(ret->bytes()));
+        }
     }
-    ret->refresh(t, offROD, srcComponents);
-    auto imgData = (float*)ret->imgMem->lock();
+    auto imgData = ret->lock();
     auto dstPix = imgData;
     for (int y=offROD.y1; y < offROD.y2; y++) {
-        if (abort()) {
-            std::cout << "abort" << std::endl;
-            break;
-        }
+        if (abort()) {break;}
         auto offPix = (float*)offImg->getPixelAddress(offROD.x1, y);
         for (int x=offROD.x1; x < offROD.x2; x++) {
             int xSrc = round(x + offPix[0] * renderScale.x);
             int ySrc = round(y + offPix[1] * renderScale.y);
-            float* srcPix = NULL;
+            const float* srcPix = NULL;
             if (xSrc >= srcROD.x1 && xSrc < srcROD.x2
                 && ySrc >= srcROD.y1 && ySrc < srcROD.y2)
             {
@@ -172,18 +207,12 @@ CachedOutput* OffsetMapPlugin::getOutput(double t, OfxPointD renderScale)
             offPix += offComponents;
         }
     }
-    ret->imgMem->unlock();
-    if (srcImgCached) {
-        srcImgCached->imgMem->unlock();
-    }
+    ret->unlock();
     if (abort()) {
+        if (keep) {
+            _cache.erase(ret);
+        }
         return NULL;
     }
-    _cachedOutputByTime[t] = ret;
-    ret->inCache = true;
-    _nextCacheIndex++;
-    if (_nextCacheIndex >= MAX_CACHE_OUTPUTS) {
-        _nextCacheIndex = 0;
-    }
     return ret;
 }
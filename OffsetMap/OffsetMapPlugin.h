@@ -1,5 +1,6 @@
 #include "ofxsImageEffect.h"
 #include "ofxsMacros.h"
+#include "OffsetMapCache.h"
 #include <iostream>
 
 using namespace OFX;
@@ -24,27 +25,13 @@ using namespace OFX;
 #define kParamReferenceFrameLabel "Reference Frame"
 #define kParamReferenceFrameHint "Reference Frame"
 
-#define MAX_CACHE_OUTPUTS 10
+#define kParamCacheSize "cacheSize"
+#define kParamCacheSizeLabel "Cache Size (MB)"
+#define kParamCacheSizeHint "Most memory to keep outputs in, so iterating temporally doesn't have to go all the way back to the reference frame each time"
 
-
-class CachedOutput {
-public:
-    bool inCache = false;
-    double time;
-    OfxRectI rod;
-    int components;
-    auto_ptr<ImageMemory> imgMem;
-    void refresh(double t, OfxRectI newROD, int comps) {
-        time = t;
-        components = comps;
-        rod = newROD;
-        auto width = newROD.x2 - newROD.x1;
-        auto height = newROD.y2 - newROD.y1;
-        imgMem.reset(
-            new ImageMemory(width * height * comps * sizeof(float))
-        );
-    }
-};
+#define kParamCheckpointInterval "checkpointInterval"
+#define kParamCheckpointIntervalLabel "Checkpoint Interval"
+#define kParamCheckpointIntervalHint "Every this many frames from the reference frame, outputs are kept over others when the cache is full, so a frame is never far from one"
 
 
 class OffsetMapPlugin : public ImageEffect
@@ -69,16 +56,30 @@ private:
 
     CachedOutput* getOutput(double t, OfxPointD renderScale);
 
+    // t's output drawn from the source clip, see drawOutput
+    CachedOutput* getOutputFromSource(double t, OfxPointD renderScale, bool keep, CachedOutput* working);
+
+    // whether t's output is kept over others in the cache
+    bool isCheckpoint(double t);
+
+    // t's output drawn from srcImgData, into the cache if keep,
+    // otherwise into working. NULL when there are no offsets or it's aborted
+    CachedOutput* drawOutput(
+        double t, OfxPointD renderScale,
+        const float* srcImgData, OfxRectI srcROD, int srcComponents,
+        bool keep, CachedOutput* working
+    );
+
 private:
     Clip* _srcClip;
     Clip* _offClip;
     Clip* _dstClip;
     BooleanParam* _iterateTemporally;
     IntParam* _referenceFrame;
+    IntParam* _cacheSize;
+    IntParam* _checkpointInterval;
 
     bool _haveLastRenderArgs = false;
     RenderArguments _lastRenderArgs;
-    int _nextCacheIndex = 0;
-    CachedOutput _cachedOutputs[MAX_CACHE_OUTPUTS];
-    std::map<double, CachedOutput*> _cachedOutputByTime;
+    OffsetMapCache _cache;
 };
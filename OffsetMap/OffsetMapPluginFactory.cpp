@@ -72,6 +72,30 @@ void OffsetMapPluginFactory::describeInContext(ImageEffectDescriptor &desc, Cont
             page->addChild(*param);
         }
     }
+    {
+        auto param = desc.defineIntParam(kParamCacheSize);
+        param->setLabel(kParamCacheSizeLabel);
+        param->setHint(kParamCacheSizeHint);
+        param->setDefault(1024);
+        param->setRange(0, 1048576);
+        param->setDisplayRange(0, 16384);
+        param->setAnimates(false);
+        if (page) {
+            page->addChild(*param);
+        }
+    }
+    {
+        auto param = desc.defineIntParam(kParamCheckpointInterval);
+        param->setLabel(kParamCheckpointIntervalLabel);
+        param->setHint(kParamCheckpointIntervalHint);
+        param->setDefault(10);
+        param->setRange(1, 1000);
+        param->setDisplayRange(1, 100);
+        param->setAnimates(false);
+        if (page) {
+            page->addChild(*param);
+        }
+    }
 }
 
 ImageEffect* OffsetMapPluginFactory::createInstance(OfxImageEffectHandle handle, ContextEnum /*context*/)
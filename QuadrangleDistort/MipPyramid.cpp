@@ -0,0 +1,116 @@
+#include "MipPyramid.h"
+#include <cassert>
+#include <cmath>
+
+using namespace QuadrangleDistort;
+
+
+MipPyramid::MipPyramid(Image* img) {
+    _bounds = img->getBounds();
+    _components = img->getPixelComponentCount();
+    assert(_components <= MIPPYRAMID_MAX_COMPONENTS);
+
+    // level 0 is a straight copy
+    Level level;
+    level.width = std::max(1, _bounds.x2 - _bounds.x1);
+    level.height = std::max(1, _bounds.y2 - _bounds.y1);
+    level.data.assign(size_t(level.width) * level.height * _components, 0);
+    auto rowLength = (_bounds.x2 - _bounds.x1) * _components;
+    for (int y=_bounds.y1; y < _bounds.y2; y++) {
+        auto srcPix = (float*)img->getPixelAddress(_bounds.x1, y);
+        if (!srcPix) {continue;}
+        std::copy(srcPix, srcPix + rowLength, level.data.begin() + size_t(y - _bounds.y1) * rowLength);
+    }
+    _levels.push_back(std::move(level));
+
+    // each next level averages 2x2 of the last, repeating the last row
+    // or column of an odd sized one
+    while (_levels.back().width > 1 || _levels.back().height > 1) {
+        auto& prev = _levels.back();
+        Level next;
+        next.width = (prev.width + 1) / 2;
+        next.height = (prev.height + 1) / 2;
+        next.data.resize(size_t(next.width) * next.height * _components);
+        auto nextPix = next.data.data();
+        for (int y=0; y < next.height; y++) {
+            for (int x=0; x < next.width; x++, nextPix += _components) {
+                auto p00 = prev.pixel(x * 2, y * 2, _components);
+                auto p10 = prev.pixel(x * 2 + 1, y * 2, _components);
+                auto p01 = prev.pixel(x * 2, y * 2 + 1, _components);
+                auto p11 = prev.pixel(x * 2 + 1, y * 2 + 1, _components);
+                for (int c=0; c < _components; c++) {
+                    nextPix[c] = 0.25f * (p00[c] + p10[c] + p01[c] + p11[c]);
+                }
+            }
+        }
+        _levels.push_back(std::move(next));
+    }
+}
+
+void MipPyramid::bilinear(int level, double x, double y, float* outPix) const {
+    auto& lvl = _levels[level];
+    // pixel centres line up between levels
+    auto scale = 1.0 / (1 << level);
+    x = (x - _bounds.x1 + 0.5) * scale - 0.5;
+    y = (y - _bounds.y1 + 0.5) * scale - 0.5;
+    auto floorX = floor(x);
+    auto floorY = floor(y);
+    auto weightX = x - floorX;
+    auto weightY = y - floorY;
+    auto p00 = lvl.pixel(floorX, floorY, _components);
+    auto p10 = lvl.pixel(floorX + 1, floorY, _components);
+    auto p01 = lvl.pixel(floorX, floorY + 1, _components);
+    auto p11 = lvl.pixel(floorX + 1, floorY + 1, _components);
+    for (int c=0; c < _components; c++) {
+        outPix[c] = (
+            (1 - weightY) * ((1 - weightX) * p00[c] + weightX * p10[c])
+            + weightY * ((1 - weightX) * p01[c] + weightX * p11[c])
+        );
+    }
+}
+
+void MipPyramid::trilinear(double lod, double x, double y, float* outPix) const {
+    lod = std::max(0.0, std::min(double(levelCount() - 1), lod));
+    int level = floor(lod);
+    auto weight = lod - level;
+    bilinear(level, x, y, outPix);
+    if (weight <= 0 || level + 1 >= levelCount()) {return;}
+    float coarser[MIPPYRAMID_MAX_COMPONENTS];
+    bilinear(level + 1, x, y, coarser);
+    for (int c=0; c < _components; c++) {
+        outPix[c] += weight * (coarser[c] - outPix[c]);
+    }
+}
+
+void MipPyramid::sample(double x, double y, const double jacobian[2][2], float* outPix) const {
+    auto lengthX = sqrt(jacobian[0][0] * jacobian[0][0] + jacobian[1][0] * jacobian[1][0]);
+    auto lengthY = sqrt(jacobian[0][1] * jacobian[0][1] + jacobian[1][1] * jacobian[1][1]);
+    auto major = std::max(lengthX, lengthY);
+    if (!(major > 1)) {
+        // magnified, or near enough 1:1
+        bilinear(0, x, y, outPix);
+        return;
+    }
+    auto minor = std::min(lengthX, lengthY);
+    int axis = lengthX >= lengthY ? 0 : 1;
+    auto anisotropy = std::min(double(MIPPYRAMID_MAX_ANISOTROPY), major / std::max(minor, 1e-9));
+    auto lod = log2(std::max(1.0, major / anisotropy));
+    int taps = std::max(1, int(ceil(anisotropy - 0.01)));
+    if (taps == 1) {
+        trilinear(lod, x, y, outPix);
+        return;
+    }
+    // spread the taps evenly along the longer axis
+    float tapPix[MIPPYRAMID_MAX_COMPONENTS];
+    for (int c=0; c < _components; c++) {outPix[c] = 0;}
+    for (int t=0; t < taps; t++) {
+        auto offset = (t + 0.5) / taps - 0.5;
+        trilinear(lod, x + offset * jacobian[0][axis], y + offset * jacobian[1][axis], tapPix);
+        for (int c=0; c < _components; c++) {
+            outPix[c] += tapPix[c];
+        }
+    }
+    for (int c=0; c < _components; c++) {
+        outPix[c] /= taps;
+    }
+}
@@ -0,0 +1,60 @@
+#ifndef MIPPYRAMID_H
+#define MIPPYRAMID_H
+
+#include "ofxsImageEffect.h"
+#include <vector>
+
+// how stretched a footprint can be before it's sampled more coarsely
+#define MIPPYRAMID_MAX_ANISOTROPY 8
+// RGBA at most
+#define MIPPYRAMID_MAX_COMPONENTS 4
+
+using namespace OFX;
+
+
+namespace QuadrangleDistort {
+    // An image and successively halved, box filtered, copies of it,
+    // so a footprint covering many of its pixels can be sampled without aliasing.
+    class MipPyramid {
+        public:
+
+        MipPyramid(Image* img);
+
+        inline int levelCount() const {return _levels.size();}
+
+        // bilinear sample of one level.
+        // x and y are in the image's pixel coordinates, as for bilinear
+        void bilinear(int level, double x, double y, float* outPix) const;
+
+        // Anisotropic trilinear sample of the footprint of an output pixel.
+        // jacobian holds how far x,y moves for a step of the output pixel
+        // along x (first column) and along y (second column).
+        // A few taps are taken along the footprint's longer axis, from the
+        // level matching its shorter one.
+        void sample(double x, double y, const double jacobian[2][2], float* outPix) const;
+
+        private:
+
+        class Level {
+            public:
+
+            int width;
+            int height;
+            std::vector<float> data;
+
+            inline const float* pixel(int x, int y, int components) const {
+                x = std::max(0, std::min(width - 1, x));
+                y = std::max(0, std::min(height - 1, y));
+                return data.data() + (size_t(y) * width + x) * components;
+            }
+        };
+
+        void trilinear(double lod, double x, double y, float* outPix) const;
+
+        OfxRectI _bounds;
+        int _components;
+        std::vector<Level> _levels;
+    };
+}
+
+#endif // def MIPPYRAMID_H
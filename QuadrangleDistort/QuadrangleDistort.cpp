@@ -1,4 +1,6 @@
 #include "QuadrangleDistort.h"
+#include <algorithm>
+#include <climits>
 #include <iostream>
 
 using namespace QuadrangleDistort;
@@ -61,6 +63,16 @@ bool Edge::initialise() {
     return true;
 }
 
+void Edge::initialiseReversed(const Edge& edge, OfxPointD end) {
+    p = end;
+    vect.x = -edge.vect.x;
+    vect.y = -edge.vect.y;
+    length = edge.length;
+    norm.x = -edge.norm.x;
+    norm.y = -edge.norm.y;
+    isInitialised = edge.isInitialised;
+}
+
 double Edge::crosses(const Edge* edge) {
     auto denom = vect.y * edge->vect.x - vect.x * edge->vect.y;
     if (denom == 0) {
@@ -117,10 +129,10 @@ bool Quadrangle::initialise() {
     return true;
 }
 
-void Quadrangle::bounds(OfxRectI *rect) {
-    rect->x2 = rect->x1 = edges[0].p.x;
-    rect->y2 = rect->y1 = edges[0].p.y;
-    for (int i=1; i < 4; i++) {
+void Quadrangle::bounds(OfxRectI *rect) const {
+    rect->x1 = rect->y1 = INT_MAX;
+    rect->x2 = rect->y2 = INT_MIN;
+    for (int i=0; i < 4; i++) {
         rect->x1 = std::min(rect->x1, (int)floor(edges[i].p.x));
         rect->x2 = std::max(rect->x2, (int)ceil(edges[i].p.x));
         rect->y1 = std::min(rect->y1, (int)floor(edges[i].p.y));
@@ -131,12 +143,14 @@ void Quadrangle::bounds(OfxRectI *rect) {
 // Polygon
 
 void Polygon::addPoint(OfxPointD p) {
-    if (edges.size() > 0) {
+    if (edgeCount > 0) {
         initialiseLastEdgeVect(p);
     }
-    Edge edge;
-    edge.p = p;
-    edges.push_back(edge);
+    assert(edgeCount < QUADRANGLEDISTORT_MAX_POLYGON_EDGES);
+    if (edgeCount >= QUADRANGLEDISTORT_MAX_POLYGON_EDGES) {return;}
+    auto edge = &edges[edgeCount++];
+    edge->p = p;
+    edge->isInitialised = false;
 }
 
 void Polygon::addPoint(OfxPointI p) {
@@ -151,16 +165,16 @@ void Polygon::close() {
 }
 
 void Polygon::clear() {
-    edges.clear();
+    edgeCount = 0;
 }
 
 void Polygon::cut(Edge* cutEdge, Polygon* res) {
-    if (edges.size() == 0) {return;}
+    if (edgeCount == 0) {return;}
     // establish whether the first edge's first point is inside
     double insideNess = 0;
     OfxPointD crossPoint;
-    for (auto edgeIter=edges.begin(); edgeIter < edges.end(); edgeIter++) {
-        auto edge = *edgeIter;
+    for (int i=0; i < edgeCount; i++) {
+        auto& edge = edges[i];
         // lost track of whether we're inside or not
         if (insideNess == 0) {
             insideNess = calcInsideNess(edge.p, cutEdge);
@@ -172,8 +186,13 @@ void Polygon::cut(Edge* cutEdge, Polygon* res) {
         // to the point
         if (insideNess == 0) {continue;}
         auto cross = edge.crosses(cutEdge);
-        if (cross < 0 || cross >= 1) {continue;}
-        if (cross == 0) {
+        if (cross < 0 || cross > 1) {continue;}
+        if (cross == 1) {
+            // snapped onto the end. The next edge starts there, but its own
+            // cross needn't snap to 0, so it works out its side afresh
+            insideNess = 0;
+        }
+        else if (cross == 0) {
             insideNess = 0;
             res->addPoint(edge.p);
         }
@@ -184,13 +203,13 @@ void Polygon::cut(Edge* cutEdge, Polygon* res) {
             res->addPoint(crossPoint);
         }
     }
-    if (res->edges.size() > 0) {
+    if (res->edgeCount > 0) {
         res->close();
     }
 }
 
 double Polygon::area() {
-    if (edges.size() < 3) {
+    if (edgeCount < 3) {
         return 0;
     }
     // start with tri made with first 2 edges
@@ -198,14 +217,14 @@ double Polygon::area() {
     double total = triangleArea(tri);
     Edge secondEdge;
     // keep making triangles using next edge and one made connecting with start
-    for (auto edgeIter = edges.begin() + 2; (edgeIter + 1) < edges.end(); edgeIter++) {
-        tri[0] = &*edgeIter;
+    for (int i=2; i + 1 < edgeCount; i++) {
+        tri[0] = &edges[i];
         // if next edge isn't the last,
         // we'll need to create a new edge to the first point
-        if (edgeIter + 2 < edges.end()) {
+        if (i + 2 < edgeCount) {
             // create an edge from the end of this edge (i.e. start of next)
             // to the first point
-            secondEdge.p = (edgeIter + 1)->p;
+            secondEdge.p = edges[i + 1].p;
             vectorSubtract(edges[0].p, secondEdge.p, &secondEdge.vect);
             if (!secondEdge.initialise()) {
                 continue;
@@ -214,7 +233,7 @@ double Polygon::area() {
         }
         // if next edge is the last, then it already goes to the start point
         else {
-            tri[1] = &edges.back();
+            tri[1] = &edges[edgeCount - 1];
         }
         total += triangleArea(tri);
     }
@@ -222,13 +241,13 @@ double Polygon::area() {
 }
 
 void Polygon::initialiseLastEdgeVect(OfxPointD toP) {
-    auto lastEdge = &edges.back();
+    auto lastEdge = &edges[edgeCount - 1];
     vectorSubtract(toP, lastEdge->p, &lastEdge->vect);
     if (!lastEdge->initialise()) {
         // penultimate edge now becomes last edge.
         // redirect it to this point
-        edges.pop_back();
-        if (edges.size() > 0) {
+        edgeCount--;
+        if (edgeCount > 0) {
             initialiseLastEdgeVect(toP);
             return;
         }
@@ -237,130 +256,19 @@ void Polygon::initialiseLastEdgeVect(OfxPointD toP) {
 
 // QuadranglePixel
 
-QuadranglePixel::QuadranglePixel(Quadrangle* quad, OfxPointD p)
+QuadranglePixel::QuadranglePixel(Quadrangle* quad, OfxPointD p, bool withIntersection)
 : quadrangle(quad), p(p) {
     auto fromPPtr = _fromP;
     for (int i=0; i < 4; i++, fromPPtr++) {
         vectorSubtract(p, quadrangle->edges[i].p, fromPPtr);
     }
-    calcIntersection();
+    if (withIntersection) {
+        calcIntersection();
+    }
 }
 
 void QuadranglePixel::calculateIdentityPoint(OfxPointD* idP) {
-    auto e0 = quadrangle->edges[0].vect;
-    auto e1 = quadrangle->edges[1].vect;
-    auto e2 = quadrangle->edges[2].vect;
-    auto e3 = quadrangle->edges[3].vect;
-    auto d = e0.x;
-    auto D = e0.y;
-    auto f = e1.x;
-    auto F = e1.y;
-    auto g = e2.x;
-    auto G = e2.y;
-    auto h = e3.x;
-    auto H = e3.y;
-    auto q = _fromP[0].x;
-    auto Q = _fromP[0].y;
-
-    double denom;
-
-    // https://www.wolframalpha.com/input/?i=solve+u*d+%2B+a*%28%28-h+%2B+u*-g%29+-+u*d%29+%3D+q%2C+u*D+%2B+a*%28%28-H+%2B+u*-G%29+-+u*D%29+%3D+Q%2C+for+u%2C+a
-    denom = 2 * (D * g - d * G);
-    if (denom < -QUADRANGLEDISTORT_DELTA || denom > QUADRANGLEDISTORT_DELTA) {
-        // == X ==
-        idP->x = (
-            (
-                sqrt(
-                    pow(
-                        -d * H - d * Q + D * h + D * q - g * Q + G * q,
-                        2
-                    )
-                    - 4 * (D * g - d * G) * (H * q - h * Q)
-                )
-                + d * H + d * Q - D * h - D * q + g * Q - G * q
-            )
-            / denom
-        );
-
-        // == Y ==
-        // https://www.wolframalpha.com/input/?i=solve+v*-h+%2B+b*%28%28d+%2B+v*f%29+-+v*-h%29+%3D+q%2C+v*-H+%2B+b*%28%28D+%2B+v*F%29+-+v*-H%29+%3D+Q%2C+for+v%2C+b
-        denom = 2 * (F * h - f * H);
-        if (denom < -QUADRANGLEDISTORT_DELTA || denom > QUADRANGLEDISTORT_DELTA) {
-            idP->y = (
-                (
-                    sqrt(
-                        pow(
-                            - d * H + D * h - f * Q + F * q - h * Q + H * q,
-                            2
-                        )
-                        - 4 * (D * q - d * Q) * (F * h - f * H)
-                    )
-                    + d * H - D * h + f * Q - F * q + h * Q - H * q
-                )
-                / denom
-            );
-        }
-        // f,F and h,H are parallel
-        else {
-            // (u[d,D] -> q,Q)'s component length in -h,-H's direction
-            // over the length of the line made by u([d,D]) -> [-h,-H] + u([-g,-G])
-            // that line:
-            // (-h + u*-g) - ud
-            // -h - ug - ud
-            // -h - u(g + d)
-            // result:
-            // ((q - ud)*-h + (Q - uD)*-H) / (<-h,-H length> * sqrt((-h - u(g + d))^2 + (-H - u(G + D))^2))
-            // (h(ud - q) + H(uD - Q)) / (<-h,-H length> * sqrt((-h - u(g + d))^2 + (-H - u(G + D))^2))
-            denom = (
-                quadrangle->edges[3].length
-                * sqrt(
-                    pow(-h - idP->x * (g + d), 2)
-                    + pow(-H - idP->x * (G + D), 2)
-                )
-            );
-            assert(denom != 0);
-            idP->y = (h * (idP->x * d - q) + H * (idP->x * D - Q)) / denom;
-        }
-    }
-    // d,D and g,G are parallel
-    else {
-        // == Y ==
-        // length of q,Q's component in d,D's normal's direction:
-        // (-Dq + dQ) / sqrt(d^2 + D^2)
-        // over length of f,F's component in d,D's normal's direction:
-        // (-D*f + d*F) / sqrt(d^2 + D^2)
-        // denoms cancel out:
-        // (-Dq + dQ) / (-Df + dF)
-        // (dQ - Dq) / (dF - Df)
-        denom = d * F - D * f;
-        // d,D not parallel with f,F
-        if (denom < -QUADRANGLEDISTORT_DELTA || denom > QUADRANGLEDISTORT_DELTA) {
-            idP->y = (d * Q - D * q) / denom;
-        }
-        // if parallel, it's crushed
-        else {
-            idP->y = 0.5;
-        }
-
-        // == X ==
-        // (v[-h,-H] -> q,Q)'s component length in d,D's direction
-        // over the length of the vector made by v([-h,-H]) -> [d,D] + v([f,F])
-        // that line:
-        // ((d + vf) - v*-h)
-        // d + v(f + h)
-        // result:
-        // (d(q - v*-h) + D(Q - v*-H)) / (<length of d,D> * sqrt((d + v(f + h))^2 + (D + v(F + H))^2))
-        // (d(q + vh) + D(Q + vH)) / (<length of d,D> * sqrt((d + v(f + h))^2 + (D + v(F + H))^2))
-        denom = (
-            quadrangle->edges[0].length
-            * sqrt(
-                pow(d + idP->y * (f + h), 2)
-                + pow(D + idP->y * (F + H), 2)
-            )
-        );
-        assert(denom != 0);
-        idP->x = (d * (q + idP->y * h) + D * (Q + idP->y * H)) / denom;
-    }
+    QuadrangleInverse(quadrangle).identityPoint(p, idP);
 }
 
 void QuadranglePixel::calcIntersection() {
@@ -393,7 +301,7 @@ void QuadranglePixel::calcIntersection() {
     // dp2 = dp1 + a*x2 + b*y2
     bool allInside = true;
     for (int i=0; i < 4 && allInside; i++) {
-        for (int j=1; j < 4 && allInside; j++) {
+        for (int j=0; j < 4 && allInside; j++) {
             allInside = (
                 dists[i]
                 + (j % 3 ? quadrangle->edges[i].norm.x : 0)
@@ -406,29 +314,303 @@ void QuadranglePixel::calcIntersection() {
         return;
     }
 
-    // Cut up the pixel
-    Polygon polies[2];
-    polies[0].addPoint(p);
+    // Cut up the pixel, back and forth between intersectionPoly and
+    // another, so the fourth cut leaves the result where it's wanted
+    Polygon cutPoly;
+    Polygon* polies[2] = {&intersectionPoly, &cutPoly};
+    polies[0]->clear();
+    polies[0]->addPoint(p);
     OfxPointD nextP;
     // bottom right
     nextP.x = p.x + 1;
     nextP.y = p.y;
-    polies[0].addPoint(nextP);
+    polies[0]->addPoint(nextP);
     // top right
     nextP.y += 1;
-    polies[0].addPoint(nextP);
+    polies[0]->addPoint(nextP);
     // top left
     nextP.x = p.x;
-    polies[0].addPoint(nextP);
-    polies[0].close();
+    polies[0]->addPoint(nextP);
+    polies[0]->close();
     Polygon *outPoly;
     for (int i=0; i < 4; i++) {
-        outPoly = polies + 1 - (i % 2);
+        outPoly = polies[1 - (i % 2)];
         outPoly->clear();
-        polies[i % 2].cut(&quadrangle->edges[i], outPoly);
+        polies[i % 2]->cut(&quadrangle->edges[i], outPoly);
     }
     intersection = outPoly->area();
-    intersectionPoly = *outPoly;
+}
+
+// QuadrangleInverse
+
+QuadrangleInverse::QuadrangleInverse(const Quadrangle* quad) {
+    _origin = quad->edges[0].p;
+    _d = quad->edges[0].vect.x;
+    _D = quad->edges[0].vect.y;
+    _f = quad->edges[1].vect.x;
+    _F = quad->edges[1].vect.y;
+    _g = quad->edges[2].vect.x;
+    _G = quad->edges[2].vect.y;
+    _h = quad->edges[3].vect.x;
+    _H = quad->edges[3].vect.y;
+    _length0 = quad->edges[0].length;
+    _length3 = quad->edges[3].length;
+    _crushed = false;
+    _uq = _uQ = _vq = _vQ = 0;
+
+    // == X ==
+    // https://www.wolframalpha.com/input/?i=solve+u*d+%2B+a*%28%28-h+%2B+u*-g%29+-+u*d%29+%3D+q%2C+u*D+%2B+a*%28%28-H+%2B+u*-G%29+-+u*D%29+%3D+Q%2C+for+u%2C+a
+    // u = (sqrt(A^2 - 4(Dg - dG)(Hq - hQ)) - A) / 2(Dg - dG)
+    // A = -dH - dQ + Dh + Dq - gQ + Gq
+    // == Y ==
+    // https://www.wolframalpha.com/input/?i=solve+v*-h+%2B+b*%28%28d+%2B+v*f%29+-+v*-h%29+%3D+q%2C+v*-H+%2B+b*%28%28D+%2B+v*F%29+-+v*-H%29+%3D+Q%2C+for+v%2C+b
+    // v = (sqrt(B^2 - 4(Dq - dQ)(Fh - fH)) - B) / 2(Fh - fH)
+    // B = -dH + Dh - fQ + Fq - hQ + Hq
+    _denomX = 2 * (_D * _g - _d * _G);
+    _denomY = 2 * (_F * _h - _f * _H);
+    _a0 = -_d * _H + _D * _h;
+    auto parallel02 = !(_denomX < -QUADRANGLEDISTORT_DELTA || _denomX > QUADRANGLEDISTORT_DELTA);
+    auto parallel13 = !(_denomY < -QUADRANGLEDISTORT_DELTA || _denomY > QUADRANGLEDISTORT_DELTA);
+    if (!parallel02) {
+        // f,F and h,H parallel:
+        // (u[d,D] -> q,Q)'s component length in -h,-H's direction
+        // over the length of the line made by u([d,D]) -> [-h,-H] + u([-g,-G])
+        kind = parallel13 ? eTrapezoid13 : eGeneral;
+        return;
+    }
+
+    // d,D and g,G parallel:
+    // v is the length of q,Q's component in d,D's normal's direction
+    // over that of f,F, (dQ - Dq) / (dF - Df),
+    // u the length of (v[-h,-H] -> q,Q)'s component in d,D's direction
+    // over the length of the vector made by v([-h,-H]) -> [d,D] + v([f,F])
+    auto denom = _d * _F - _D * _f;
+    // if d,D is parallel with f,F too it's crushed
+    _crushed = !(denom < -QUADRANGLEDISTORT_DELTA || denom > QUADRANGLEDISTORT_DELTA);
+    if (!_crushed) {
+        _vq = -_D / denom;
+        _vQ = _d / denom;
+    }
+    if (!parallel13 || _crushed) {
+        kind = eTrapezoid02;
+        return;
+    }
+    // a parallelogram, where d + v(f + h) is just d,
+    // so u is linear in q,Q too
+    kind = eAffine;
+    auto lengthSq = _length0 * _length0;
+    auto vTerm = _d * _h + _D * _H;
+    _uq = (_d + _vq * vTerm) / lengthSq;
+    _uQ = (_D + _vQ * vTerm) / lengthSq;
+}
+
+void QuadrangleInverse::rowIdentityPoints(int y, int x1, int x2, OfxPointD* points) const {
+    // Q stays put along the row, so its terms come out of the loops
+    auto Q = y - _origin.y;
+    auto q = x1 - _origin.x;
+    auto count = x2 - x1;
+    switch (kind) {
+        case eAffine: {
+            // stepped, as it's linear
+            OfxPointD idP = {_uq * q + _uQ * Q, _vq * q + _vQ * Q};
+            for (int i=0; i < count; i++) {
+                points[i] = idP;
+                idP.x += _uq;
+                idP.y += _vq;
+            }
+            break;
+        }
+        case eTrapezoid02:
+            for (int i=0; i < count; i++, q++) {
+                auto v = _crushed ? 0.5 : _vq * q + _vQ * Q;
+                points[i].x = _trapezoid02U(q, Q, v);
+                points[i].y = v;
+            }
+            break;
+        case eTrapezoid13:
+            for (int i=0; i < count; i++, q++) {
+                auto u = _generalU(q, Q);
+                points[i].x = u;
+                points[i].y = _trapezoid13V(q, Q, u);
+            }
+            break;
+        default:
+            for (int i=0; i < count; i++, q++) {
+                points[i].x = _generalU(q, Q);
+                points[i].y = _generalV(q, Q);
+            }
+    }
+}
+
+// QuadrangleRasteriser
+
+QuadrangleRasteriser::QuadrangleRasteriser(const Quadrangle* quad)
+: _quad(quad)
+, _inverse(quad) {
+    quad->bounds(&_bounds);
+}
+
+void QuadrangleRasteriser::rowSpan(int y, RowSpan* span) const {
+    // Pixel x of this row is entirely inside an edge when its innermost
+    // corner is, i.e. norm.x * x + minOffset >= 0, and touches the inside
+    // when its outermost corner does, i.e. norm.x * x + maxOffset > 0
+    double coverX1 = _bounds.x1;
+    double coverX2 = _bounds.x2;
+    double insideX1 = _bounds.x1;
+    double insideX2 = _bounds.x2;
+    if (y < _bounds.y1 || y >= _bounds.y2) {
+        coverX2 = coverX1;
+    }
+    for (int i=0; i < 4; i++) {
+        auto edge = &_quad->edges[i];
+        auto norm = edge->norm;
+        auto offset = norm.y * (y - edge->p.y) - norm.x * edge->p.x;
+        auto minOffset = offset + std::min(0.0, norm.x) + std::min(0.0, norm.y);
+        auto maxOffset = offset + std::max(0.0, norm.x) + std::max(0.0, norm.y);
+        if (norm.x > 0) {
+            insideX1 = std::max(insideX1, ceil(-minOffset / norm.x));
+            coverX1 = std::max(coverX1, floor(-maxOffset / norm.x) + 1);
+        } else if (norm.x < 0) {
+            insideX2 = std::min(insideX2, floor(-minOffset / norm.x) + 1);
+            coverX2 = std::min(coverX2, ceil(-maxOffset / norm.x));
+        } else {
+            if (minOffset < 0) {insideX2 = insideX1;}
+            if (maxOffset <= 0) {coverX2 = coverX1;}
+        }
+    }
+    span->coverX1 = coverX1;
+    span->coverX2 = std::max(coverX1, coverX2);
+    // only what's covered can be inside
+    span->insideX1 = std::max(insideX1, coverX1);
+    span->insideX2 = std::min(insideX2, coverX2);
+    if (span->insideX1 >= span->insideX2) {
+        span->insideX1 = span->insideX2 = span->coverX2;
+    }
+}
+
+double QuadrangleRasteriser::pixelCoverage(int x, int y, OfxPointD* polyPoints, int* polyCount) const {
+    // Sutherland-Hodgman, cutting the pixel by each edge in turn
+    OfxPointD points[2][QUADRANGLEDISTORT_MAX_CLIP_POINTS];
+    int counts[2] = {4, 0};
+    points[0][0] = {double(x), double(y)};
+    points[0][1] = {double(x + 1), double(y)};
+    points[0][2] = {double(x + 1), double(y + 1)};
+    points[0][3] = {double(x), double(y + 1)};
+    int in = 0;
+    for (int i=0; i < 4 && counts[in]; i++) {
+        auto cutEdge = &_quad->edges[i];
+        auto inPoints = points[in];
+        auto outPoints = points[1 - in];
+        auto inCount = counts[in];
+        int outCount = 0;
+        auto prev = inPoints[inCount - 1];
+        auto prevInsideNess = calcInsideNess(prev, cutEdge);
+        for (int j=0; j < inCount; j++) {
+            auto cur = inPoints[j];
+            auto curInsideNess = calcInsideNess(cur, cutEdge);
+            if ((prevInsideNess < 0 && curInsideNess > 0) || (prevInsideNess > 0 && curInsideNess < 0)) {
+                auto t = prevInsideNess / (prevInsideNess - curInsideNess);
+                if (outCount < QUADRANGLEDISTORT_MAX_CLIP_POINTS) {
+                    outPoints[outCount++] = {prev.x + (cur.x - prev.x) * t, prev.y + (cur.y - prev.y) * t};
+                }
+            }
+            if (curInsideNess >= 0 && outCount < QUADRANGLEDISTORT_MAX_CLIP_POINTS) {
+                outPoints[outCount++] = cur;
+            }
+            prev = cur;
+            prevInsideNess = curInsideNess;
+        }
+        counts[1 - in] = outCount;
+        in = 1 - in;
+    }
+    auto count = counts[in];
+    auto resPoints = points[in];
+    double area = 0;
+    for (int j=0; j < count; j++) {
+        auto a = resPoints[j];
+        auto b = resPoints[(j + 1) % count];
+        area += a.x * b.y - b.x * a.y;
+    }
+    area = std::max(0.0, std::min(1.0, area / 2));
+    if (polyPoints && polyCount) {
+        *polyCount = count;
+        std::copy(resPoints, resPoints + count, polyPoints);
+    }
+    return area;
+}
+
+void QuadrangleRasteriser::rowSamples(int y, int x1, int x2, double* coverage, OfxPointD* identityPoints) const {
+    if (x2 <= x1) {return;}
+    if (coverage) {
+        RowSpan span;
+        rowSpan(y, &span);
+        auto coverX1 = std::max(x1, std::min(x2, span.coverX1));
+        auto coverX2 = std::max(coverX1, std::min(x2, span.coverX2));
+        auto insideX1 = std::max(coverX1, std::min(coverX2, span.insideX1));
+        auto insideX2 = std::max(insideX1, std::min(coverX2, span.insideX2));
+        std::fill(coverage, coverage + (coverX1 - x1), 0.0);
+        for (int x=coverX1; x < insideX1; x++) {
+            coverage[x - x1] = pixelCoverage(x, y);
+        }
+        std::fill(coverage + (insideX1 - x1), coverage + (insideX2 - x1), 1.0);
+        for (int x=insideX2; x < coverX2; x++) {
+            coverage[x - x1] = pixelCoverage(x, y);
+        }
+        std::fill(coverage + (coverX2 - x1), coverage + (x2 - x1), 0.0);
+    }
+    if (identityPoints) {
+        _inverse.rowIdentityPoints(y, x1, x2, identityPoints);
+    }
+}
+
+// QuadrangleHomography
+
+bool QuadrangleHomography::initialise(const Quadrangle* quad) {
+    auto p0 = quad->edges[0].p;
+    auto p1 = quad->edges[1].p;
+    auto p2 = quad->edges[2].p;
+    auto p3 = quad->edges[3].p;
+    double g, h;
+    auto sx = p0.x - p1.x + p2.x - p3.x;
+    auto sy = p0.y - p1.y + p2.y - p3.y;
+    if (sx == 0 && sy == 0) {
+        // a parallelogram, so affine
+        g = 0;
+        h = 0;
+    } else {
+        // Heckbert's square to quadrilateral
+        auto dx1 = p1.x - p2.x;
+        auto dx2 = p3.x - p2.x;
+        auto dy1 = p1.y - p2.y;
+        auto dy2 = p3.y - p2.y;
+        auto denom = dx1 * dy2 - dx2 * dy1;
+        if (denom == 0) {return false;}
+        g = (sx * dy2 - dx2 * sy) / denom;
+        h = (dx1 * sy - sx * dy1) / denom;
+    }
+    forward[0][0] = p1.x - p0.x + g * p1.x;
+    forward[0][1] = p3.x - p0.x + h * p3.x;
+    forward[0][2] = p0.x;
+    forward[1][0] = p1.y - p0.y + g * p1.y;
+    forward[1][1] = p3.y - p0.y + h * p3.y;
+    forward[1][2] = p0.y;
+    forward[2][0] = g;
+    forward[2][1] = h;
+    forward[2][2] = 1;
+
+    // the adjugate will do, as scale doesn't matter
+    auto m = forward;
+    inverse[0][0] = m[1][1] * m[2][2] - m[1][2] * m[2][1];
+    inverse[0][1] = m[0][2] * m[2][1] - m[0][1] * m[2][2];
+    inverse[0][2] = m[0][1] * m[1][2] - m[0][2] * m[1][1];
+    inverse[1][0] = m[1][2] * m[2][0] - m[1][0] * m[2][2];
+    inverse[1][1] = m[0][0] * m[2][2] - m[0][2] * m[2][0];
+    inverse[1][2] = m[0][2] * m[1][0] - m[0][0] * m[1][2];
+    inverse[2][0] = m[1][0] * m[2][1] - m[1][1] * m[2][0];
+    inverse[2][1] = m[0][1] * m[2][0] - m[0][0] * m[2][1];
+    inverse[2][2] = m[0][0] * m[1][1] - m[0][1] * m[1][0];
+    auto det = m[0][0] * inverse[0][0] + m[0][1] * inverse[1][0] + m[0][2] * inverse[2][0];
+    return det != 0;
 }
 
 void QuadrangleDistort::bilinear(double x, double y, Image* img, float* outPix, int componentCount) {
@@ -451,3 +633,30 @@ void QuadrangleDistort::bilinear(double x, double y, Image* img, float* outPix,
         }
     }
 }
+
+// BilinearSampler
+
+BilinearSampler::BilinearSampler(Image* img) {
+    _bounds = img->getBounds();
+    _components = img->getPixelComponentCount();
+    _rowBytes = img->getRowBytes();
+    _base = (const char*)img->getPixelAddress(_bounds.x1, _bounds.y1);
+}
+
+void BilinearSampler::_sampleAny(double x, double y, float* outPix) const {
+    auto floorX = floor(x);
+    auto floorY = floor(y);
+    float weightX = x - floorX;
+    float weightY = y - floorY;
+    int x0 = floorX;
+    int y0 = floorY;
+    auto p00 = _pixel(x0, y0);
+    auto p10 = _pixel(x0 + 1, y0);
+    auto p01 = _pixel(x0, y0 + 1);
+    auto p11 = _pixel(x0 + 1, y0 + 1);
+    for (int c=0; c < _components; c++) {
+        auto bottom = p00[c] + weightX * (p10[c] - p00[c]);
+        auto top = p01[c] + weightX * (p11[c] - p01[c]);
+        outPix[c] = bottom + weightY * (top - bottom);
+    }
+}
@@ -1,4 +1,6 @@
 #include "ofxsImageEffect.h"
+#include <algorithm>
+#include <cmath>
 
 // our smallest distance for snapping and
 // dealing with rounding errors in calculations.
@@ -9,6 +11,12 @@
 // needed to make a 1x1 pixel have that possible area.
 #define QUADRANGLEDISTORT_DELTA 0.000030759
 
+// a pixel square cut by a quadrangle's four edges
+// can have at most this many corners
+#define QUADRANGLEDISTORT_MAX_CLIP_POINTS 8
+// room for the repeated points snapping can add while cutting
+#define QUADRANGLEDISTORT_MAX_POLYGON_EDGES (QUADRANGLEDISTORT_MAX_CLIP_POINTS * 2)
+
 using namespace OFX;
 
 
@@ -23,6 +31,8 @@ namespace QuadrangleDistort {
     double vectorDotProduct(const OfxPointD a, const OfxPointD b);
     void rectIntersect(const OfxRectI* a, const OfxRectI* b, OfxRectI* res);
 
+    // From p along vect. norm is vect turned a quarter anticlockwise,
+    // so for an anticlockwise polygon it points inside.
     class Edge {
         public:
 
@@ -32,27 +42,44 @@ namespace QuadrangleDistort {
         OfxPointD norm;
         bool isInitialised = false;
 
+        // false for a zero length vect, leaving norm and length unset
         bool initialise();
+        // edge walked the other way from its end p, copied rather than
+        // recalculated, so neighbours sharing it get exactly the same one
+        void initialiseReversed(const Edge& edge, OfxPointD end);
+        // how far along this edge the line through edge crosses it,
+        // snapped to exactly 0 or 1 within QUADRANGLEDISTORT_DELTA.
+        // INFINITY when they're parallel
         double crosses(const Edge* edge);
     };
 
+    // signed area of the triangle made by edges[1] following on from edges[0]
     double triangleArea(Edge* edges[2]);
+    // distance of p inside cutEdge, snapped to exactly 0 within
+    // QUADRANGLEDISTORT_DELTA so points on the edge count as inside
     double calcInsideNess(const OfxPointD p, const Edge* cutEdge);
 
+    // Corners anticlockwise from edges[0].p.
+    // The coverage and identity points assume it's convex.
     class Quadrangle {
         public:
 
         Edge edges[4];
 
+        // false if any corners coincide
         bool initialise();
 
-        void bounds(OfxRectI *rect);
+        void bounds(OfxRectI *rect) const;
     };
 
+    // A polygon of up to QUADRANGLEDISTORT_MAX_POLYGON_EDGES edges,
+    // kept in place so cutting up pixels never allocates.
+    // Points past that are dropped.
     class Polygon {
         public:
 
-        std::vector<Edge> edges;
+        Edge edges[QUADRANGLEDISTORT_MAX_POLYGON_EDGES];
+        int edgeCount = 0;
 
         void addPoint(OfxPointD p);
         void addPoint(OfxPointI p);
@@ -72,9 +99,13 @@ namespace QuadrangleDistort {
         Quadrangle* quadrangle;
         OfxPointD p;
         double intersection;
+        // the pixel cut by the quadrangle, left empty when
+        // it's entirely inside or outside
         Polygon intersectionPoly;
 
-        QuadranglePixel(Quadrangle* quad, OfxPointD p);
+        // withIntersection false leaves intersection unset,
+        // for when only the identity point is wanted
+        QuadranglePixel(Quadrangle* quad, OfxPointD p, bool withIntersection = true);
         void calculateIdentityPoint(OfxPointD* idP);
 
         private:
@@ -84,5 +115,234 @@ namespace QuadrangleDistort {
         OfxPointD _fromP[4];
     };
 
+    // calculateIdentityPoint's solve, worked out once for a quadrangle.
+    // With edges 0 and 2 parallel as well as 1 and 3 it's a parallelogram
+    // and the mapping is affine. With one pair parallel it's a trapezoid,
+    // needing one square root. Otherwise it needs two.
+    class QuadrangleInverse {
+        public:
+
+        enum Kind {
+            eGeneral,
+            eTrapezoid02,   // edges 0 and 2 parallel
+            eTrapezoid13,   // edges 1 and 3 parallel
+            eAffine
+        };
+
+        Kind kind;
+
+        QuadrangleInverse(const Quadrangle* quad);
+
+        inline void identityPoint(const OfxPointD p, OfxPointD* idP) const {
+            auto q = p.x - _origin.x;
+            auto Q = p.y - _origin.y;
+            switch (kind) {
+                case eAffine:
+                    idP->x = _uq * q + _uQ * Q;
+                    idP->y = _vq * q + _vQ * Q;
+                    break;
+                case eTrapezoid02:
+                    idP->y = _crushed ? 0.5 : _vq * q + _vQ * Q;
+                    idP->x = _trapezoid02U(q, Q, idP->y);
+                    break;
+                case eTrapezoid13:
+                    idP->x = _generalU(q, Q);
+                    idP->y = _trapezoid13V(q, Q, idP->x);
+                    break;
+                default:
+                    idP->x = _generalU(q, Q);
+                    idP->y = _generalV(q, Q);
+            }
+        }
+
+        // identity points of pixels [x1, x2) of row y, into an array of x2 - x1
+        void rowIdentityPoints(int y, int x1, int x2, OfxPointD* points) const;
+
+        private:
+
+        // see calculateIdentityPoint for where these come from
+        inline double _generalU(double q, double Q) const {
+            auto A = (_D + _G) * q + _a0 - (_d + _g) * Q;
+            return (sqrt(std::max(0.0, A * A - 2 * _denomX * (_H * q - _h * Q))) - A) / _denomX;
+        }
+
+        inline double _generalV(double q, double Q) const {
+            auto B = (_F + _H) * q + _a0 - (_f + _h) * Q;
+            return (sqrt(std::max(0.0, B * B - 2 * _denomY * (_D * q - _d * Q))) - B) / _denomY;
+        }
+
+        inline double _trapezoid13V(double q, double Q, double u) const {
+            auto lx = -_h - u * (_g + _d);
+            auto ly = -_H - u * (_G + _D);
+            return (_h * (u * _d - q) + _H * (u * _D - Q)) / (_length3 * sqrt(lx * lx + ly * ly));
+        }
+
+        inline double _trapezoid02U(double q, double Q, double v) const {
+            auto lx = _d + v * (_f + _h);
+            auto ly = _D + v * (_F + _H);
+            return (_d * (q + v * _h) + _D * (Q + v * _H)) / (_length0 * sqrt(lx * lx + ly * ly));
+        }
+
+        OfxPointD _origin;
+        double _d, _D, _f, _F, _g, _G, _h, _H;
+        double _denomX;
+        double _denomY;
+        double _a0;
+        double _length0;
+        double _length3;
+        bool _crushed;
+        // the linear parts: affine u and v, or a trapezoid's v
+        double _uq, _uQ, _vq, _vQ;
+    };
+
+    // The pixels of a row that a quadrangle touches, [coverX1, coverX2),
+    // and those it entirely covers, [insideX1, insideX2).
+    // Only the pixels in between need their coverage working out.
+    class RowSpan {
+        public:
+
+        int coverX1;
+        int coverX2;
+        int insideX1;
+        int insideX2;
+
+        inline bool isEmpty() const {return coverX1 >= coverX2;}
+        inline bool isInside(int x) const {return x >= insideX1 && x < insideX2;}
+        inline bool isCovered(int x) const {return x >= coverX1 && x < coverX2;}
+    };
+
+    // Rasterises a quadrangle's coverage a row at a time.
+    // The spans come straight from each edge's line, and the boundary
+    // pixels are cut up on the stack, without any allocation.
+    class QuadrangleRasteriser {
+        public:
+
+        QuadrangleRasteriser(const Quadrangle* quad);
+
+        void rowSpan(int y, RowSpan* span) const;
+
+        // area of pixel x,y inside the quadrangle.
+        // If polyPoints is given, it gets the corners of that area,
+        // up to QUADRANGLEDISTORT_MAX_CLIP_POINTS of them.
+        double pixelCoverage(int x, int y, OfxPointD* polyPoints = NULL, int* polyCount = NULL) const;
+
+        // Coverage and identity points of pixels [x1, x2) of row y, into
+        // arrays of x2 - x1 each, either of which can be NULL.
+        // The row's span sorts it into runs that are filled without testing
+        // each pixel, leaving only the edge pixels to be cut up.
+        // Every pixel gets an identity point, as calculateIdentityPoint's.
+        void rowSamples(int y, int x1, int x2, double* coverage, OfxPointD* identityPoints) const;
+
+        private:
+
+        const Quadrangle* _quad;
+        OfxRectI _bounds;
+        QuadrangleInverse _inverse;
+    };
+
+    // The projective mapping of the unit square onto a quadrangle,
+    // taking 0,0 to edges[0].p, 1,0 to edges[1].p, 1,1 to edges[2].p
+    // and 0,1 to edges[3].p, along with its inverse.
+    // Unlike calculateIdentityPoint's bilinear mapping, points along a line
+    // stay along a line, so the inverse can be stepped along a row.
+    class QuadrangleHomography {
+        public:
+
+        double forward[3][3];
+        double inverse[3][3];
+
+        bool initialise(const Quadrangle* quad);
+
+        // homogeneous identity point of p. Divide by the last to get u,v
+        inline void inverseHomogeneous(const OfxPointD p, double* uvw) const {
+            for (int r=0; r < 3; r++) {
+                uvw[r] = inverse[r][0] * p.x + inverse[r][1] * p.y + inverse[r][2];
+            }
+        }
+    };
+
     void bilinear(double x, double y, Image* img, float* outPix, int componentCount);
+
+    // bilinear, with the image's layout looked up once rather than for every tap.
+    // Fills outPix with all of the image's components.
+    // 3 and 4 components get their own fixed size blends,
+    // which compilers turn into vector instructions.
+    class BilinearSampler {
+        public:
+
+        BilinearSampler(Image* img);
+
+        inline int getPixelComponentCount() const {return _components;}
+
+        inline void sample(double x, double y, float* outPix) const {
+            switch (_components) {
+                case 4: _sample<4>(x, y, outPix); break;
+                case 3: _sample<3>(x, y, outPix); break;
+                default: _sampleAny(x, y, outPix);
+            }
+        }
+
+        // the first count components, and how fast each changes along x
+        // and along y, from the same four taps
+        inline void sampleSlopes(double x, double y, int count, float* outPix, float* outDx, float* outDy) const {
+            auto floorX = floor(x);
+            auto floorY = floor(y);
+            float weightX = x - floorX;
+            float weightY = y - floorY;
+            int x0 = floorX;
+            int y0 = floorY;
+            auto p00 = _pixel(x0, y0);
+            auto p10 = _pixel(x0 + 1, y0);
+            auto p01 = _pixel(x0, y0 + 1);
+            auto p11 = _pixel(x0 + 1, y0 + 1);
+            for (int c=0; c < count; c++) {
+                auto bottom = p00[c] + weightX * (p10[c] - p00[c]);
+                auto top = p01[c] + weightX * (p11[c] - p01[c]);
+                outPix[c] = bottom + weightY * (top - bottom);
+                outDx[c] = p10[c] - p00[c] + weightY * (p11[c] - p01[c] - p10[c] + p00[c]);
+                outDy[c] = top - bottom;
+            }
+        }
+
+        private:
+
+        // the tap at x,y, with the nearest edge pixel outside the bounds
+        inline const float* _pixel(int x, int y) const {
+            x = std::max(_bounds.x1, std::min(_bounds.x2 - 1, x));
+            y = std::max(_bounds.y1, std::min(_bounds.y2 - 1, y));
+            return (const float*)(
+                _base + ptrdiff_t(y - _bounds.y1) * _rowBytes
+            ) + (x - _bounds.x1) * _components;
+        }
+
+        template <int N>
+        inline void _sample(double x, double y, float* outPix) const {
+            auto floorX = floor(x);
+            auto floorY = floor(y);
+            float weightX = x - floorX;
+            float weightY = y - floorY;
+            int x0 = floorX;
+            int y0 = floorY;
+            auto p00 = _pixel(x0, y0);
+            auto p10 = _pixel(x0 + 1, y0);
+            auto p01 = _pixel(x0, y0 + 1);
+            auto p11 = _pixel(x0 + 1, y0 + 1);
+            float bottom[N];
+            float top[N];
+            for (int c=0; c < N; c++) {
+                bottom[c] = p00[c] + weightX * (p10[c] - p00[c]);
+                top[c] = p01[c] + weightX * (p11[c] - p01[c]);
+            }
+            for (int c=0; c < N; c++) {
+                outPix[c] = bottom[c] + weightY * (top[c] - bottom[c]);
+            }
+        }
+
+        void _sampleAny(double x, double y, float* outPix) const;
+
+        const char* _base;
+        ptrdiff_t _rowBytes;
+        OfxRectI _bounds;
+        int _components;
+    };
 }
@@ -0,0 +1,522 @@
+#include "../QuadrangleDistort.h"
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <random>
+#include <vector>
+
+// convex quads of each kind, and degenerate ones of each kind
+#define TEST_QUAD_COUNT 2000
+// quads timed for each kernel
+#define BENCH_QUAD_COUNT 200
+#define BENCH_QUAD_SIZE 40
+
+// coverage snaps by up to QUADRANGLEDISTORT_DELTA, a few times over per edge pixel
+#define AREA_TOLERANCE 1e-4
+#define COVERAGE_TOLERANCE 1e-4
+#define ROUND_TRIP_TOLERANCE 1e-9
+// crosses and cuts away from any snapping
+#define EXACT_TOLERANCE 1e-9
+
+using namespace QuadrangleDistort;
+
+
+// The Support library wants the plugins to list their factories,
+// and there aren't any here.
+void OFX::Plugin::getPluginIDs(OFX::PluginFactoryArray& /*ids*/) {}
+
+namespace {
+    int _failures = 0;
+
+    void _check(bool ok, const char* what, int quadIndex, double error) {
+        if (ok) {return;}
+        if (_failures < 20) {
+            printf("FAIL %s, quad %d, error %g\n", what, quadIndex, error);
+        }
+        _failures++;
+    }
+
+    double _shoelaceArea(const Quadrangle& quad) {
+        double area = 0;
+        for (int i=0; i < 4; i++) {
+            auto& a = quad.edges[i].p;
+            auto& b = quad.edges[(i + 1) % 4].p;
+            area += a.x * b.y - b.x * a.y;
+        }
+        return area / 2;
+    }
+
+    bool _isConvex(const Quadrangle& quad) {
+        for (int i=0; i < 4; i++) {
+            auto& a = quad.edges[i].vect;
+            auto& b = quad.edges[(i + 1) % 4].vect;
+            if (a.x * b.y - a.y * b.x <= 0) {return false;}
+        }
+        return true;
+    }
+
+    // where calculateIdentityPoint's bilinear mapping takes u,v
+    OfxPointD _bilinearForward(const Quadrangle& quad, double u, double v) {
+        auto& a = quad.edges[0].p;
+        auto& b = quad.edges[1].p;
+        auto& c = quad.edges[2].p;
+        auto& d = quad.edges[3].p;
+        return {
+            (1 - u) * (1 - v) * a.x + u * (1 - v) * b.x + u * v * c.x + (1 - u) * v * d.x,
+            (1 - u) * (1 - v) * a.y + u * (1 - v) * b.y + u * v * c.y + (1 - u) * v * d.y
+        };
+    }
+
+    // Corners at angles around a centre, anticlockwise.
+    // Every kind of QuadrangleInverse is made in turn, by moving a corner
+    // so edges come out parallel.
+    Quadrangle _randomConvexQuad(std::mt19937& rng, int index) {
+        std::uniform_real_distribution<double> wobble(-0.6, 0.6);
+        std::uniform_real_distribution<double> radius(0.3, 30);
+        std::uniform_real_distribution<double> centre(-20, 20);
+        Quadrangle quad;
+        OfxPointD c = {centre(rng), centre(rng)};
+        for (int i=0; i < 4; i++) {
+            auto angle = i * M_PI / 2 + wobble(rng);
+            auto r = radius(rng);
+            quad.edges[i].p = {c.x + r * cos(angle), c.y + r * sin(angle)};
+        }
+        auto& p = quad.edges;
+        switch (index % 4) {
+            case 1:
+                // parallelogram
+                p[2].p = {p[1].p.x + p[3].p.x - p[0].p.x, p[1].p.y + p[3].p.y - p[0].p.y};
+                break;
+            case 2:
+                // edges 0 and 2 parallel
+                p[2].p = {p[3].p.x + (p[1].p.x - p[0].p.x) * 0.6, p[3].p.y + (p[1].p.y - p[0].p.y) * 0.6};
+                break;
+            case 3:
+                // edges 1 and 3 parallel
+                p[3].p = {p[0].p.x + (p[2].p.x - p[1].p.x) * 0.7, p[0].p.y + (p[2].p.y - p[1].p.y) * 0.7};
+                break;
+        }
+        return quad;
+    }
+
+    // Corners that snapping has to cope with: a corner on the line between
+    // its neighbours, a sliver thinner than a pixel, a quad inside one pixel,
+    // and corners a hair either side of a pixel's edge.
+    Quadrangle _randomDegenerateQuad(std::mt19937& rng, int index) {
+        std::uniform_real_distribution<double> coord(-20, 20);
+        std::uniform_real_distribution<double> fraction(0.1, 0.9);
+        Quadrangle quad;
+        auto& p = quad.edges;
+        switch (index % 4) {
+            case 0: {
+                // a triangle, with corner 1 along the edge from 0 to 2
+                OfxPointD a = {coord(rng), coord(rng)};
+                OfxPointD b = {coord(rng), coord(rng)};
+                OfxPointD c = {coord(rng), coord(rng)};
+                if ((b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x) < 0) {std::swap(b, c);}
+                auto t = fraction(rng);
+                p[0].p = a;
+                p[1].p = {a.x + t * (b.x - a.x), a.y + t * (b.y - a.y)};
+                p[2].p = b;
+                p[3].p = c;
+                break;
+            }
+            case 1: {
+                // a sliver, along a random direction
+                auto angle = fraction(rng) * 2 * M_PI;
+                OfxPointD along = {cos(angle) * 30, sin(angle) * 30};
+                OfxPointD across = {-along.y * 0.0005, along.x * 0.0005};
+                OfxPointD a = {coord(rng), coord(rng)};
+                p[0].p = a;
+                p[1].p = {a.x + along.x, a.y + along.y};
+                p[2].p = {a.x + along.x + across.x, a.y + along.y + across.y};
+                p[3].p = {a.x + across.x, a.y + across.y};
+                break;
+            }
+            case 2: {
+                // inside one pixel
+                OfxPointD a = {floor(coord(rng)) + 0.1, floor(coord(rng)) + 0.1};
+                p[0].p = a;
+                p[1].p = {a.x + 0.7, a.y};
+                p[2].p = {a.x + 0.8, a.y + 0.6};
+                p[3].p = {a.x, a.y + 0.8};
+                break;
+            }
+            default: {
+                // axis aligned, with corners within QUADRANGLEDISTORT_DELTA of pixel edges
+                auto x1 = floor(coord(rng));
+                auto y1 = floor(coord(rng));
+                auto x2 = x1 + 1 + floor(fraction(rng) * 10);
+                auto y2 = y1 + 1 + floor(fraction(rng) * 10);
+                auto hair = QUADRANGLEDISTORT_DELTA * (fraction(rng) - 0.5);
+                p[0].p = {x1 + hair, y1 - hair};
+                p[1].p = {x2 - hair, y1 + hair};
+                p[2].p = {x2 + hair, y2 - hair};
+                p[3].p = {x1 - hair, y2 + hair};
+            }
+        }
+        return quad;
+    }
+
+    // Pixel by pixel and row by row coverage both sum to the quad's area,
+    // and agree with each other.
+    void _checkCoverage(Quadrangle* quad, int index) {
+        auto area = _shoelaceArea(*quad);
+        OfxRectI bounds;
+        quad->bounds(&bounds);
+        bounds.x1--;
+        bounds.y1--;
+        bounds.x2++;
+        bounds.y2++;
+        QuadrangleRasteriser rasteriser(quad);
+        std::vector<double> coverage(bounds.x2 - bounds.x1);
+        double pixelSum = 0;
+        double rowSum = 0;
+        double worst = 0;
+        for (int y=bounds.y1; y < bounds.y2; y++) {
+            rasteriser.rowSamples(y, bounds.x1, bounds.x2, coverage.data(), NULL);
+            for (int x=bounds.x1; x < bounds.x2; x++) {
+                auto pixelCoverage = QuadranglePixel(quad, {double(x), double(y)}).intersection;
+                pixelSum += pixelCoverage;
+                rowSum += coverage[x - bounds.x1];
+                worst = std::max(worst, fabs(pixelCoverage - coverage[x - bounds.x1]));
+            }
+        }
+        _check(fabs(pixelSum - area) <= AREA_TOLERANCE, "QuadranglePixel coverage sums to area", index, pixelSum - area);
+        _check(fabs(rowSum - area) <= AREA_TOLERANCE, "rowSamples coverage sums to area", index, rowSum - area);
+        _check(worst <= COVERAGE_TOLERANCE, "rowSamples coverage matches QuadranglePixel", index, worst);
+    }
+
+    // Identity points taken forward onto the quad and back again.
+    void _checkRoundTrip(Quadrangle* quad, int index) {
+        QuadrangleInverse inverse(quad);
+        QuadrangleHomography homography;
+        auto hasHomography = homography.initialise(quad);
+        double worst = 0;
+        double worstHomography = 0;
+        for (int k=0; k < 100; k++) {
+            auto u = (k % 10 + 0.5) / 10;
+            auto v = (k / 10 + 0.5) / 10;
+            auto p = _bilinearForward(*quad, u, v);
+            OfxPointD idP;
+            inverse.identityPoint(p, &idP);
+            worst = std::max(worst, std::max(fabs(idP.x - u), fabs(idP.y - v)));
+            QuadranglePixel(quad, p, false).calculateIdentityPoint(&idP);
+            worst = std::max(worst, std::max(fabs(idP.x - u), fabs(idP.y - v)));
+
+            if (!hasHomography) {continue;}
+            auto& f = homography.forward;
+            auto w = f[2][0] * u + f[2][1] * v + f[2][2];
+            OfxPointD projected = {
+                (f[0][0] * u + f[0][1] * v + f[0][2]) / w,
+                (f[1][0] * u + f[1][1] * v + f[1][2]) / w
+            };
+            double uvw[3];
+            homography.inverseHomogeneous(projected, uvw);
+            worstHomography = std::max(worstHomography, std::max(
+                fabs(uvw[0] / uvw[2] - u), fabs(uvw[1] / uvw[2] - v)
+            ));
+        }
+        _check(worst <= ROUND_TRIP_TOLERANCE, "bilinear forward then inverse", index, worst);
+        _check(worstHomography <= ROUND_TRIP_TOLERANCE, "homography forward then inverse", index, worstHomography);
+        _check(hasHomography, "homography of a convex quad", index, 0);
+
+        // the row at a time identity points are the same as one at a time,
+        // inside the quad. Outside it the solve is free to go anywhere
+        OfxRectI bounds;
+        quad->bounds(&bounds);
+        std::vector<OfxPointD> row(bounds.x2 - bounds.x1);
+        double worstRow = 0;
+        for (int y=bounds.y1; y < bounds.y2; y++) {
+            inverse.rowIdentityPoints(y, bounds.x1, bounds.x2, row.data());
+            for (int x=bounds.x1; x < bounds.x2; x++) {
+                OfxPointD idP;
+                inverse.identityPoint({double(x), double(y)}, &idP);
+                auto& rowP = row[x - bounds.x1];
+                if (!(idP.x >= 0 && idP.x <= 1 && idP.y >= 0 && idP.y <= 1)) {continue;}
+                worstRow = std::max(worstRow, std::max(fabs(idP.x - rowP.x), fabs(idP.y - rowP.y)));
+            }
+        }
+        _check(worstRow <= ROUND_TRIP_TOLERANCE, "rowIdentityPoints matches identityPoint", index, worstRow);
+    }
+
+    void _testConvex() {
+        std::mt19937 rng(1);
+        int tested = 0;
+        int kinds[4] = {};
+        for (int i=0; i < TEST_QUAD_COUNT; i++) {
+            auto quad = _randomConvexQuad(rng, i);
+            if (!quad.initialise() || !_isConvex(quad)) {continue;}
+            tested++;
+            kinds[QuadrangleInverse(&quad).kind]++;
+            _checkCoverage(&quad, i);
+            _checkRoundTrip(&quad, i);
+        }
+        printf(
+            "convex: %d quads, %d general, %d trapezoid 0-2, %d trapezoid 1-3, %d affine\n",
+            tested, kinds[QuadrangleInverse::eGeneral], kinds[QuadrangleInverse::eTrapezoid02],
+            kinds[QuadrangleInverse::eTrapezoid13], kinds[QuadrangleInverse::eAffine]
+        );
+    }
+
+    void _testDegenerate() {
+        std::mt19937 rng(2);
+        int tested = 0;
+        for (int i=0; i < TEST_QUAD_COUNT; i++) {
+            auto quad = _randomDegenerateQuad(rng, i);
+            if (!quad.initialise()) {continue;}
+            tested++;
+            _checkCoverage(&quad, i);
+        }
+        printf("degenerate: %d quads\n", tested);
+
+        // coinciding corners leave an edge with no direction
+        int accepted = 0;
+        for (int i=0; i < TEST_QUAD_COUNT; i++) {
+            auto quad = _randomConvexQuad(rng, i);
+            quad.edges[(i + 1) % 4].p = quad.edges[i % 4].p;
+            if (quad.initialise()) {accepted++;}
+        }
+        _check(accepted == 0, "coinciding corners are rejected", -1, accepted);
+    }
+
+    Edge _edge(OfxPointD p, OfxPointD vect) {
+        Edge edge;
+        edge.p = p;
+        edge.vect = vect;
+        edge.initialise();
+        return edge;
+    }
+
+    // area of pixel x,y left inside cutEdge
+    double _cutPixel(int x, int y, Edge cutEdge) {
+        Polygon pixel;
+        Polygon cut;
+        pixel.addPoint(OfxPointI{x, y});
+        pixel.addPoint(OfxPointI{x + 1, y});
+        pixel.addPoint(OfxPointI{x + 1, y + 1});
+        pixel.addPoint(OfxPointI{x, y + 1});
+        pixel.close();
+        pixel.cut(&cutEdge, &cut);
+        return cut.area();
+    }
+
+    // Edge::crosses, Polygon::cut and Polygon::area on their own,
+    // with the snapping at QUADRANGLEDISTORT_DELTA pinned down
+    void _testEdgesAndPolygons() {
+        std::mt19937 rng(4);
+        std::uniform_real_distribution<double> coord(-20, 20);
+        std::uniform_real_distribution<double> fraction(0.01, 0.99);
+        std::uniform_real_distribution<double> unit(-1, 1);
+        std::uniform_real_distribution<double> angle(0, 2 * M_PI);
+
+        for (int i=0; i < TEST_QUAD_COUNT; i++) {
+            // an edge, and lines through it at t along it
+            auto edge = _edge({coord(rng), coord(rng)}, {coord(rng), coord(rng)});
+            auto crossingAt = [&](double t) {
+                auto a = angle(rng);
+                OfxPointD through = {edge.p.x + edge.vect.x * t, edge.p.y + edge.vect.y * t};
+                auto line = _edge(through, {cos(a), sin(a)});
+                return edge.crosses(&line);
+            };
+            auto t = fraction(rng);
+            auto cross = crossingAt(t);
+            _check(fabs(cross - t) <= EXACT_TOLERANCE, "crosses along an edge", i, cross - t);
+
+            // within DELTA of either end is exactly that end
+            auto nearby = unit(rng) * QUADRANGLEDISTORT_DELTA * 0.5;
+            cross = crossingAt(nearby);
+            _check(cross == 0, "crosses snaps to 0 near the start", i, cross);
+            cross = crossingAt(1 + nearby);
+            _check(cross == 1, "crosses snaps to 1 near the end", i, cross - 1);
+            // and further away isn't
+            cross = crossingAt(-QUADRANGLEDISTORT_DELTA * 4);
+            _check(cross != 0 && cross < 0, "crosses doesn't snap before the start", i, cross);
+
+            // parallel lines, either way along, never cross
+            auto scale = ldexp(1.0, i % 7 - 3) * (i % 2 ? 1 : -1);
+            auto parallel = _edge({coord(rng), coord(rng)}, {edge.vect.x * scale, edge.vect.y * scale});
+            cross = edge.crosses(&parallel);
+            _check(std::isinf(cross), "crosses is INFINITY for parallel edges", i, cross);
+
+            // A pixel cut by a line through two points on its sides.
+            // The inside is on the left going from the first to the second.
+            int x = floor(coord(rng));
+            int y = floor(coord(rng));
+            auto a = fraction(rng);
+            auto b = fraction(rng);
+            // across its bottom left corner, from the bottom to the left side
+            auto area = _cutPixel(x, y, _edge({x + a, double(y)}, {-a, b}));
+            _check(fabs(area - a * b / 2) <= EXACT_TOLERANCE, "cut off corner area", i, area - a * b / 2);
+            area = _cutPixel(x, y, _edge({double(x), y + b}, {a, -b}));
+            _check(fabs(area - (1 - a * b / 2)) <= EXACT_TOLERANCE, "cut leaving all but a corner", i, area - (1 - a * b / 2));
+            // from the bottom to the top, keeping the left
+            area = _cutPixel(x, y, _edge({x + a, double(y)}, {b - a, 1}));
+            _check(fabs(area - (a + b) / 2) <= EXACT_TOLERANCE, "cut across area", i, area - (a + b) / 2);
+            // clear of the pixel, either side
+            area = _cutPixel(x, y, _edge({x - 2.0, double(y)}, {0, 1}));
+            _check(area == 0, "cut clear outside", i, area);
+            area = _cutPixel(x, y, _edge({x - 2.0, double(y)}, {0, -1}));
+            _check(fabs(area - 1) <= EXACT_TOLERANCE, "cut clear inside", i, area - 1);
+
+            // through within snapping distance of the pixel's corners,
+            // steeply, so one side snaps and the other needn't
+            auto steep = 1 / (4 + 20 * fraction(rng));
+            auto graze = unit(rng) * QUADRANGLEDISTORT_DELTA * 4;
+            // from the bottom at x + a to near the top left corner
+            OfxPointD top = {double(x) + graze * steep, y + 1 + graze};
+            area = _cutPixel(x, y, _edge({x + a, double(y)}, {top.x - (x + a), top.y - y}));
+            // the line's x across the top, or where it leaves by the left side
+            auto topX = a + (top.x - x - a) / (top.y - y);
+            auto expected = topX >= 0 ? (a + topX) / 2 : a * a / (a - topX) / 2;
+            _check(fabs(area - expected) <= AREA_TOLERANCE, "cut grazing a corner", i, area - expected);
+
+            // area of a convex polygon, against its shoelace area
+            Polygon polygon;
+            int corners = 3 + i % (QUADRANGLEDISTORT_MAX_CLIP_POINTS - 2);
+            OfxPointD centre = {coord(rng), coord(rng)};
+            auto radius = 0.1 + fraction(rng) * 10;
+            auto start = angle(rng);
+            double shoelace = 0;
+            OfxPointD points[QUADRANGLEDISTORT_MAX_CLIP_POINTS];
+            for (int k=0; k < corners; k++) {
+                auto cornerAngle = start + 2 * M_PI * k / corners;
+                points[k] = {centre.x + radius * cos(cornerAngle), centre.y + radius * sin(cornerAngle)};
+                polygon.addPoint(points[k]);
+            }
+            polygon.close();
+            for (int k=0; k < corners; k++) {
+                auto& p = points[k];
+                auto& q = points[(k + 1) % corners];
+                shoelace += (p.x * q.y - q.x * p.y) / 2;
+            }
+            area = polygon.area();
+            _check(fabs(area - shoelace) <= EXACT_TOLERANCE * radius * radius, "polygon area", i, area - shoelace);
+        }
+        printf("edges and polygons: %d of each\n", TEST_QUAD_COUNT);
+    }
+
+    // ns per pixel of f(quad, x, y), over every pixel of each quad's bounds
+    template <class F>
+    void _bench(const char* name, std::vector<Quadrangle>& quads, F f) {
+        double sink = 0;
+        long pixels = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (auto& quad : quads) {
+            pixels += f(&quad, &sink);
+        }
+        auto elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start);
+        // sink keeps the work from being optimised away
+        printf("%-36s %8.1f ns/pixel%s\n", name, elapsed.count() / pixels, sink == 1e300 ? " " : "");
+    }
+
+    void _benchKernels() {
+        std::mt19937 rng(3);
+        std::uniform_real_distribution<double> jitter(-0.3, 0.3);
+        std::vector<Quadrangle> quads;
+        OfxPointD square[4] = {{0, 0}, {1, 0}, {1, 1}, {0, 1}};
+        while (quads.size() < BENCH_QUAD_COUNT) {
+            Quadrangle quad;
+            for (int i=0; i < 4; i++) {
+                quad.edges[i].p = {
+                    (square[i].x + jitter(rng)) * BENCH_QUAD_SIZE,
+                    (square[i].y + jitter(rng)) * BENCH_QUAD_SIZE
+                };
+            }
+            if (quad.initialise() && _isConvex(quad)) {quads.push_back(quad);}
+        }
+
+        auto forEachPixel = [](Quadrangle* quad, std::function<void(int, int)> f) {
+            OfxRectI bounds;
+            quad->bounds(&bounds);
+            for (int y=bounds.y1; y < bounds.y2; y++) {
+                for (int x=bounds.x1; x < bounds.x2; x++) {
+                    f(x, y);
+                }
+            }
+            return long(bounds.x2 - bounds.x1) * (bounds.y2 - bounds.y1);
+        };
+
+        _bench("QuadranglePixel coverage", quads, [&](Quadrangle* quad, double* sink) {
+            return forEachPixel(quad, [&](int x, int y) {
+                *sink += QuadranglePixel(quad, {double(x), double(y)}).intersection;
+            });
+        });
+        _bench("QuadranglePixel identity point", quads, [&](Quadrangle* quad, double* sink) {
+            return forEachPixel(quad, [&](int x, int y) {
+                OfxPointD idP;
+                QuadranglePixel(quad, {double(x), double(y)}, false).calculateIdentityPoint(&idP);
+                *sink += idP.x;
+            });
+        });
+        _bench("QuadrangleInverse::identityPoint", quads, [&](Quadrangle* quad, double* sink) {
+            QuadrangleInverse inverse(quad);
+            return forEachPixel(quad, [&](int x, int y) {
+                OfxPointD idP;
+                inverse.identityPoint({double(x), double(y)}, &idP);
+                *sink += idP.x;
+            });
+        });
+        _bench("QuadrangleInverse::rowIdentityPoints", quads, [&](Quadrangle* quad, double* sink) {
+            QuadrangleInverse inverse(quad);
+            OfxRectI bounds;
+            quad->bounds(&bounds);
+            std::vector<OfxPointD> row(bounds.x2 - bounds.x1);
+            for (int y=bounds.y1; y < bounds.y2; y++) {
+                inverse.rowIdentityPoints(y, bounds.x1, bounds.x2, row.data());
+                *sink += row[0].x;
+            }
+            return long(bounds.x2 - bounds.x1) * (bounds.y2 - bounds.y1);
+        });
+        _bench("QuadrangleRasteriser::pixelCoverage", quads, [&](Quadrangle* quad, double* sink) {
+            QuadrangleRasteriser rasteriser(quad);
+            return forEachPixel(quad, [&](int x, int y) {
+                *sink += rasteriser.pixelCoverage(x, y);
+            });
+        });
+        _bench("QuadrangleRasteriser::rowSamples", quads, [&](Quadrangle* quad, double* sink) {
+            QuadrangleRasteriser rasteriser(quad);
+            OfxRectI bounds;
+            quad->bounds(&bounds);
+            std::vector<double> coverage(bounds.x2 - bounds.x1);
+            std::vector<OfxPointD> identityPoints(bounds.x2 - bounds.x1);
+            for (int y=bounds.y1; y < bounds.y2; y++) {
+                rasteriser.rowSamples(y, bounds.x1, bounds.x2, coverage.data(), identityPoints.data());
+                *sink += coverage[0] + identityPoints[0].x;
+            }
+            return long(bounds.x2 - bounds.x1) * (bounds.y2 - bounds.y1);
+        });
+        _bench("Polygon::cut and area", quads, [&](Quadrangle* quad, double* sink) {
+            // every pixel cut by all four edges, as QuadranglePixel does at the edges
+            long pixels = 0;
+            forEachPixel(quad, [&](int x, int y) {
+                Polygon polies[2];
+                polies[0].addPoint(OfxPointI{x, y});
+                polies[0].addPoint(OfxPointI{x + 1, y});
+                polies[0].addPoint(OfxPointI{x + 1, y + 1});
+                polies[0].addPoint(OfxPointI{x, y + 1});
+                polies[0].close();
+                for (int i=0; i < 4; i++) {
+                    polies[1 - i % 2].clear();
+                    polies[i % 2].cut(&quad->edges[i], &polies[1 - i % 2]);
+                }
+                *sink += polies[0].area();
+                pixels++;
+            });
+            return pixels;
+        });
+    }
+}
+
+int main() {
+    _testEdgesAndPolygons();
+    _testConvex();
+    _testDegenerate();
+    _benchKernels();
+    if (_failures) {
+        printf("%d checks failed\n", _failures);
+        return 1;
+    }
+    printf("all checks passed\n");
+    return 0;
+}
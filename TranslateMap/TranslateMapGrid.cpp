@@ -0,0 +1,72 @@
+#include "TranslateMapGrid.h"
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <limits>
+
+
+TranslateMapGrid::TranslateMapGrid(Image* transImg, Image* nextTransImg, OfxRectI srcROD, OfxPointD transScale)
+: _srcROD(srcROD) {
+    auto width = std::max(0, srcROD.x2 - srcROD.x1);
+    auto height = std::max(0, srcROD.y2 - srcROD.y1);
+    _cols = (width + TRANSLATEMAPGRID_CELL_SIZE - 1) / TRANSLATEMAPGRID_CELL_SIZE;
+    _rows = (height + TRANSLATEMAPGRID_CELL_SIZE - 1) / TRANSLATEMAPGRID_CELL_SIZE;
+    _cells.resize(_cols * _rows);
+
+    auto inf = std::numeric_limits<double>::infinity();
+    auto cell = _cells.data();
+    for (int row=0; row < _rows; row++) {
+        auto y1 = srcROD.y1 + row * TRANSLATEMAPGRID_CELL_SIZE;
+        auto y2 = std::min(srcROD.y2, y1 + TRANSLATEMAPGRID_CELL_SIZE);
+        for (int col=0; col < _cols; col++, cell++) {
+            auto x1 = srcROD.x1 + col * TRANSLATEMAPGRID_CELL_SIZE;
+            auto x2 = std::min(srcROD.x2, x1 + TRANSLATEMAPGRID_CELL_SIZE);
+            cell->minX = cell->minY = inf;
+            cell->maxX = cell->maxY = -inf;
+            // the corners of the last pixels come from the next row and column
+            for (auto img : {transImg, nextTransImg}) {
+                if (!img) {continue;}
+                for (int y=y1; y <= y2; y++) {
+                    for (int x=x1; x <= x2; x++) {
+                        auto transPix = (float*)img->getPixelAddressNearest(x, y);
+                        auto transX = transPix[0] * transScale.x;
+                        auto transY = transPix[1] * transScale.y;
+                        if (std::isnan(transX) || std::isnan(transY)) {continue;}
+                        cell->minX = std::min(cell->minX, transX);
+                        cell->maxX = std::max(cell->maxX, transX);
+                        cell->minY = std::min(cell->minY, transY);
+                        cell->maxY = std::max(cell->maxY, transY);
+                    }
+                }
+            }
+        }
+    }
+}
+
+void TranslateMapGrid::sourceRects(OfxRectI window, std::vector<OfxRectI>* rects) const {
+    rects->clear();
+    auto cell = _cells.data();
+    for (int row=0; row < _rows; row++) {
+        auto y1 = _srcROD.y1 + row * TRANSLATEMAPGRID_CELL_SIZE;
+        auto y2 = std::min(_srcROD.y2, y1 + TRANSLATEMAPGRID_CELL_SIZE);
+        OfxRectI rect = {INT_MAX, y1, INT_MIN, y2};
+        for (int col=0; col < _cols; col++, cell++) {
+            if (cell->minX > cell->maxX) {continue;}
+            auto x1 = _srcROD.x1 + col * TRANSLATEMAPGRID_CELL_SIZE;
+            auto x2 = std::min(_srcROD.x2, x1 + TRANSLATEMAPGRID_CELL_SIZE);
+            // where the cell's quads can draw, with the pixel after for
+            // undistorted pixels landing between pixels
+            if (
+                floor(x1 + cell->minX) >= window.x2
+                || ceil(x2 + cell->maxX) + 1 <= window.x1
+                || floor(y1 + cell->minY) >= window.y2
+                || ceil(y2 + cell->maxY) + 1 <= window.y1
+            ) {continue;}
+            rect.x1 = std::min(rect.x1, x1);
+            rect.x2 = std::max(rect.x2, x2);
+        }
+        if (rect.x1 < rect.x2) {
+            rects->push_back(rect);
+        }
+    }
+}
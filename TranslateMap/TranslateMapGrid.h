@@ -0,0 +1,44 @@
+#ifndef TRANSLATEMAPGRID_H
+#define TRANSLATEMAPGRID_H
+
+#include "ofxsImageEffect.h"
+#include <vector>
+
+// source pixels along each side of a cell
+#define TRANSLATEMAPGRID_CELL_SIZE 32
+
+using namespace OFX;
+
+
+// The least and most translation over square cells of the source, so the
+// source pixels whose quads can land in a window are found without
+// building all of their quads.
+// A cell's quads take their corners from the translations of its pixels
+// and the row and column after, which is what each cell's range covers.
+class TranslateMapGrid {
+public:
+    // transScale takes translations to pixels, i.e. render scale over par.
+    // nextTransImg, if there is one, is translations the quads can be
+    // blended towards, which the ranges then cover too.
+    TranslateMapGrid(Image* transImg, Image* nextTransImg, OfxRectI srcROD, OfxPointD transScale);
+
+    // Source pixels whose quads can reach window, a rect per row of cells
+    // spanning its cells that can. Rows with none are left out.
+    void sourceRects(OfxRectI window, std::vector<OfxRectI>* rects) const;
+
+private:
+    class Cell {
+    public:
+        double minX;
+        double minY;
+        double maxX;
+        double maxY;
+    };
+
+    OfxRectI _srcROD;
+    int _cols;
+    int _rows;
+    std::vector<Cell> _cells;
+};
+
+#endif // def TRANSLATEMAPGRID_H
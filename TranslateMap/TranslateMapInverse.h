@@ -0,0 +1,66 @@
+#ifndef TRANSLATEMAPINVERSE_H
+#define TRANSLATEMAPINVERSE_H
+
+#include "ofxCore.h"
+#include <algorithm>
+#include <cmath>
+
+// most Newton steps gather takes to invert the translations,
+// and how close, in pixels, s + T(s) has to get to the output pixel
+#define GATHER_ITERATIONS 16
+#define GATHER_TOLERANCE 0.001
+
+
+// Works out where an output pixel came from, s where s + T(s) is the
+// pixel, T being the translations scaled by transScale to pixels.
+// That's solved by Newton's method from s = pixel, each step through the
+// inverse of I + J, J being T's slopes at s. With T bilinear it converges
+// from nearby wherever the translations don't fold, however much they
+// stretch or turn the source.
+class TranslateMapInverse {
+public:
+    TranslateMapInverse(OfxPointD transScale) : _transScale(transScale) {}
+
+    // slopes(x, y, trans, transDx, transDy) fills in T at x,y and how fast
+    // it changes along x and along y, in translations.
+    // jacobian, if given, gets how far s moves for a step of the pixel
+    // along x (first column) and along y (second column), as MipPyramid
+    // wants it.
+    // false if it hasn't settled in GATHER_ITERATIONS steps, or lands
+    // on a fold.
+    template <class Slopes>
+    bool invert(const Slopes& slopes, OfxPointD p, OfxPointD* srcPoint, double jacobian[2][2] = NULL) const {
+        float trans[2], transDx[2], transDy[2];
+        *srcPoint = p;
+        for (int i=0; ; i++) {
+            slopes(srcPoint->x, srcPoint->y, trans, transDx, transDy);
+            // I + J, turned over or crushed where the translations fold
+            auto a = 1 + transDx[0] * _transScale.x;
+            auto b = transDy[0] * _transScale.x;
+            auto c = transDx[1] * _transScale.y;
+            auto d = 1 + transDy[1] * _transScale.y;
+            auto det = a * d - b * c;
+            if (!(det > 0)) {return false;}
+            // how far s + T(s) is from the pixel
+            auto missX = srcPoint->x + trans[0] * _transScale.x - p.x;
+            auto missY = srcPoint->y + trans[1] * _transScale.y - p.y;
+            if (!(std::max(fabs(missX), fabs(missY)) > GATHER_TOLERANCE)) {
+                if (jacobian) {
+                    jacobian[0][0] = d / det;
+                    jacobian[0][1] = -b / det;
+                    jacobian[1][0] = -c / det;
+                    jacobian[1][1] = a / det;
+                }
+                return true;
+            }
+            if (i == GATHER_ITERATIONS) {return false;}
+            srcPoint->x -= (d * missX - b * missY) / det;
+            srcPoint->y -= (a * missY - c * missX) / det;
+        }
+    }
+
+private:
+    OfxPointD _transScale;
+};
+
+#endif // def TRANSLATEMAPINVERSE_H
@@ -1,5 +1,7 @@
 #include "TranslateMapPlugin.h"
+#include "TranslateMapSplatBuffer.h"
 #include "ofxsCoords.h"
+#include "ofxsMultiThread.h"
 #include "../QuadrangleDistort/QuadrangleDistort.h"
 
 using namespace QuadrangleDistort;
@@ -17,12 +19,33 @@ TranslateMapPlugin::TranslateMapPlugin(OfxImageEffectHandle handle)
     _dstClip = fetchClip(kOfxImageEffectOutputClipName);
     assert(_dstClip && (_dstClip->getPixelComponents() == ePixelComponentRGB ||
     	    _dstClip->getPixelComponents() == ePixelComponentRGBA));
+    _mode = fetchChoiceParam(kParamMode);
+    _filter = fetchChoiceParam(kParamFilter);
+    _motionBlurSamples = fetchIntParam(kParamMotionBlurSamples);
+    _shutter = fetchDoubleParam(kParamShutter);
+    _occlusion = fetchChoiceParam(kParamOcclusion);
+    _occlusionTolerance = fetchDoubleParam(kParamOcclusionTolerance);
 }
 
 void TranslateMapPlugin::getClipPreferences(ClipPreferencesSetter &clipPreferences) {
     clipPreferences.setClipComponents(*_dstClip, _srcClip->getPixelComponents());
 }
 
+void TranslateMapPlugin::getFramesNeeded(const FramesNeededArguments &args, FramesNeededSetter &frames) {
+    if (
+        _motionBlurSamples->getValueAtTime(args.time) <= 1
+        || _shutter->getValueAtTime(args.time) <= 0
+    ) {
+        ImageEffect::getFramesNeeded(args, frames);
+        return;
+    }
+    OfxRangeD range;
+    range.min = range.max = args.time;
+    frames.setFramesNeeded(*_srcClip, range);
+    range.max = args.time + 1;
+    frames.setFramesNeeded(*_transClip, range);
+}
+
 bool TranslateMapPlugin::isIdentity(const IsIdentityArguments &args, 
                                   Clip * &identityClip, double &/*identityTime*/
 #ifdef OFX_EXTENSIONS_NUKE
@@ -44,62 +67,526 @@ void TranslateMapPlugin::getRegionsOfInterest(const RegionsOfInterestArguments &
     rois.setRegionOfInterest(*_transClip, _transClip->getRegionOfDefinition(args.time));
 }
 
-inline void addPixelValue(OfxPointD p, float* values, int componentCount, double weight, Image* outImg, double* ratioSums, OfxRectI window) {
-    int floorX = floor(p.x);
-    int floorY = floor(p.y);
-    float* PIX;
-    auto width = window.x2 - window.x1;
-    auto height = window.y2 - window.y1;
-    float* valuePtr;
-    if (p.x == floorX && p.y == floorY) {
-        if (
-            floorX < window.x1
-            || floorX >= window.x2
-            || floorY < window.y1
-            || floorY >= window.y2
-        ) {return;}
-        PIX = (float*)outImg->getPixelAddress(floorX, floorY);
-        valuePtr = values;
-        for (int c=0; c < componentCount; c++, PIX++, valuePtr++) {
-            *PIX += *valuePtr;
+// A quad close enough to a parallelogram to be splatted as one.
+// Its identity points are then linear. Each pair of opposite edges
+// bounds a strip, and a pixel's coverage is the product of how much of
+// it lies in either strip. That's exact for each strip, so for quads
+// with edges along the axes however thin, and close otherwise, being
+// out only at pixels the corners cut.
+class AffineQuad {
+public:
+    // false when it's too far from a parallelogram, or is turned over
+    bool initialise(const Quadrangle& quad) {
+        auto& p0 = quad.edges[0].p;
+        auto& p1 = quad.edges[1].p;
+        auto& p2 = quad.edges[2].p;
+        auto& p3 = quad.edges[3].p;
+        auto skewX = p0.x - p1.x + p2.x - p3.x;
+        auto skewY = p0.y - p1.y + p2.y - p3.y;
+        if (skewX * skewX + skewY * skewY > AFFINE_QUAD_TOLERANCE * AFFINE_QUAD_TOLERANCE) {
+            return false;
         }
-        ratioSums[
-            (floorY - window.y1) * width + (floorX - window.x1)
-        ]++;
-        return;
+        _origin = p0;
+        _u = {p1.x - p0.x, p1.y - p0.y};
+        _v = {p3.x - p0.x, p3.y - p0.y};
+        _det = _u.x * _v.y - _u.y * _v.x;
+        if (_det <= 0) {return false;}
+        for (int i=0; i < 4; i++) {
+            auto& edge = quad.edges[i];
+            _norms[i] = edge.norm;
+            _offsets[i] = -vectorDotProduct(edge.p, edge.norm);
+            _wides[i] = std::max(fabs(edge.norm.x), fabs(edge.norm.y));
+            _narrows[i] = std::min(fabs(edge.norm.x), fabs(edge.norm.y));
+        }
+        return true;
     }
 
-    // we actually need to affect neighbouring pixels
-    auto weightX = p.x - floorX;
-    auto weightY = p.y - floorY;
-    int actualX, actualY;
-    double finalWeight;
-    for (int y=0; y < 2; y++) {
-        for (int x=0; x < 2; x++) {
-            actualX = floorX + x;
-            actualY = floorY + y;
+    inline void identityPoint(OfxPointD p, OfxPointD* idP) const {
+        auto dx = p.x - _origin.x;
+        auto dy = p.y - _origin.y;
+        idP->x = (dx * _v.y - dy * _v.x) / _det;
+        idP->y = (_u.x * dy - _u.y * dx) / _det;
+    }
+
+    inline double coverage(OfxPointD p) const {
+        double insides[4];
+        for (int i=0; i < 4; i++) {
+            auto dist = (p.x + 0.5) * _norms[i].x + (p.y + 0.5) * _norms[i].y + _offsets[i];
+            insides[i] = _halfPlaneCoverage(dist, _wides[i], _narrows[i]);
+        }
+        // Opposite edges are parallel, so between them they leave out
+        // what either does alone.
+        return std::max(0.0, insides[0] + insides[2] - 1) * std::max(0.0, insides[1] + insides[3] - 1);
+    }
+
+private:
+    OfxPointD _origin;
+    OfxPointD _u;
+    OfxPointD _v;
+    double _det;
+    OfxPointD _norms[4];
+    double _offsets[4];
+    double _wides[4];
+    double _narrows[4];
+
+    // How much of a pixel lies inside an edge whose unit normal has the
+    // given larger and smaller absolute components, from the distance of
+    // its centre. Across the pixel the distance is a sum of two uniform
+    // spreads, of widths wide and narrow.
+    static inline double _halfPlaneCoverage(double dist, double wide, double narrow) {
+        auto outer = (wide + narrow) / 2;
+        auto inner = (wide - narrow) / 2;
+        if (dist >= outer) {return 1;}
+        if (dist <= -outer) {return 0;}
+        if (dist > inner) {return 1 - (outer - dist) * (outer - dist) / (2 * wide * narrow);}
+        if (dist < -inner) {return (outer + dist) * (outer + dist) / (2 * wide * narrow);}
+        return 0.5 + dist / wide;
+    }
+};
+
+// Splats the source into bands of rows of the render window, a band per
+// thread. Each thread goes through just the source that can reach its band
+// and only writes inside it, so nothing is shared, at the cost of quads
+// straddling two bands being built by both.
+// For motion blur each source pixel is splatted once per sub-frame, its
+// translations blended from transImg's towards nextTransImg's.
+// With occlusion each quad has the mean priority of its corners, and only
+// the front-most of what lands on a pixel is kept.
+class TranslateMapProcessor : public MultiThread::Processor {
+public:
+    TranslateMapProcessor(
+        ImageEffect* effect, Image* transImg, Image* nextTransImg,
+        Image* srcImg, Image* dstImg, const TranslateMapGrid* grid,
+        OfxRectI window, OfxPointD transScale, int samples, double shutter,
+        int occlusion, double occlusionTolerance
+    )
+    : _effect(effect)
+    , _transImg(transImg)
+    , _nextTransImg(nextTransImg)
+    , _srcImg(srcImg)
+    , _sampler(srcImg)
+    , _dstImg(dstImg)
+    , _grid(grid)
+    , _window(window)
+    , _transScale(transScale)
+    , _samples(std::max(1, samples))
+    , _shutter(shutter)
+    , _occlusion(occlusion)
+    , _occlusionTolerance(occlusionTolerance)
+    {}
+
+    void process() {
+        auto nThreads = std::max(1u, std::min(
+            MultiThread::getNumCPUs(), unsigned(std::max(1, _window.y2 - _window.y1))
+        ));
+        multiThread(nThreads);
+    }
+
+    virtual void multiThreadFunction(unsigned int threadIndex, unsigned int threadMax) OVERRIDE FINAL {
+        auto height = _window.y2 - _window.y1;
+        auto band = _window;
+        band.y1 = _window.y1 + int(height * double(threadIndex) / threadMax);
+        band.y2 = _window.y1 + int(height * double(threadIndex + 1) / threadMax);
+        if (band.y1 >= band.y2) {return;}
+
+        auto srcComponentCount = _srcImg->getPixelComponentCount();
+        auto dstComponentCount = _dstImg->getPixelComponentCount();
+        auto componentCount = std::min(
+            srcComponentCount, dstComponentCount
+        );
+
+        // the band's sums, written out once it's all splatted
+        TranslateMapSplatBuffer buffer(
+            band, componentCount, _occlusion != 0, _occlusionTolerance
+        );
+
+        // only the source pixels that can land in the band are splatted
+        std::vector<OfxRectI> srcRects;
+        _grid->sourceRects(band, &srcRects);
+
+        OfxPointD p;
+        bool allSame;
+        Quadrangle quad;
+        OfxRectI quadBounds;
+        OfxRectI intersectBounds;
+        OfxPointD transPoint;
+        OfxPointD srcPoint;
+        AffineQuad affineQuad;
+        double intersection;
+        double priority = 0;
+        std::vector<float> values(srcComponentCount);
+        RowSpan span;
+        std::vector<double> rowCoverage(band.x2 - band.x1);
+        std::vector<OfxPointD> rowIdentityPoints(band.x2 - band.x1);
+
+        // draws the source at identity point srcPoint of p's quad
+        // into transPoint
+        auto splat = [&](double weight) {
             if (
-                actualX < window.x1
-                || actualX >= window.x2
-                || actualY < window.y1
-                || actualY >= window.y2
-            ) {continue;}
-            finalWeight = (
-                (x == 0 ? 1 - weightX : weightX)
-                * (y == 0 ? 1 - weightY : weightY)
-                * weight
-            );
-            PIX = (float*)outImg->getPixelAddress(actualX, actualY);
-            valuePtr = values;
-            for (int c=0; c < componentCount; c++, PIX++, valuePtr++) {
-                *PIX += *valuePtr * finalWeight;
+                IsNaN(srcPoint.x)
+                || IsNaN(srcPoint.y)
+            ) {
+                srcPoint.x = 0;
+                srcPoint.y = 0;
+            }
+            if (srcPoint.x < 0) {srcPoint.x = 0;}
+            if (srcPoint.x >= 1) {srcPoint.x = 1 - QUADRANGLEDISTORT_DELTA;}
+            if (srcPoint.y < 0) {srcPoint.y = 0;}
+            if (srcPoint.y >= 1) {srcPoint.y = 1 - QUADRANGLEDISTORT_DELTA;}
+            srcPoint.x += p.x;
+            srcPoint.y += p.y;
+            _sampler.sample(srcPoint.x, srcPoint.y, values.data());
+            buffer.add(transPoint, values.data(), weight, priority);
+        };
+
+        // The quads' corners are streamed a row at a time: the translations
+        // along a row of corners, and the edges between them with their
+        // translated corners as their ps. A row's edges are the tops of
+        // one row of quads and the bottoms of the one before, and the
+        // edges down a column of corners are the right of one quad and
+        // the left of the next, so each is only worked out once.
+        // Each sub-frame streams its own, from the same fetched rows.
+        std::vector<OfxPointD> fetchedTrans;
+        std::vector<OfxPointD> fetchedNextTrans;
+        std::vector<double> fetchedPriorities;
+        std::vector<double> fetchedNextPriorities;
+        std::vector<CornerRows> sampleRows(_samples);
+
+        auto fetchTrans = [&](Image* transImg, int y, int x1, int x2, OfxPointD* trans, double* priorities) {
+            auto transComponentCount = transImg->getPixelComponentCount();
+            for (int x=x1; x <= x2; x++, trans++, priorities++) {
+                auto transPIX = (float*)transImg->getPixelAddressNearest(x, y);
+                trans->x = transPIX[0] * _transScale.x;
+                trans->y = transPIX[1] * _transScale.y;
+                // in the translations' own units,
+                // so the tolerance doesn't change with render scale
+                switch (_occlusion) {
+                    case 1:
+                        *priorities = transComponentCount > 2 ? transPIX[2] : 0;
+                        break;
+                    case 2:
+                        *priorities = sqrt(transPIX[0] * transPIX[0] + transPIX[1] * transPIX[1]);
+                        break;
+                    default:
+                        *priorities = 0;
+                }
+            }
+        };
+
+        auto fetchRow = [&](int y, int x1, int x2) {
+            fetchTrans(_transImg, y, x1, x2, fetchedTrans.data(), fetchedPriorities.data());
+            if (_samples > 1) {
+                fetchTrans(_nextTransImg, y, x1, x2, fetchedNextTrans.data(), fetchedNextPriorities.data());
+            }
+            for (int k=0; k < _samples; k++) {
+                auto blend = _shutter * k / _samples;
+                auto trans = sampleRows[k].nextTrans.data();
+                auto priorities = sampleRows[k].nextPriorities.data();
+                auto edges = sampleRows[k].nextEdges.data();
+                auto fetched = fetchedTrans.data();
+                auto fetchedNext = fetchedNextTrans.data();
+                auto fetchedPriority = fetchedPriorities.data();
+                auto fetchedNextPriority = fetchedNextPriorities.data();
+                for (
+                    int x=x1; x <= x2;
+                    x++, trans++, priorities++, edges++,
+                    fetched++, fetchedNext++, fetchedPriority++, fetchedNextPriority++
+                ) {
+                    if (k == 0) {
+                        *trans = *fetched;
+                        *priorities = *fetchedPriority;
+                    } else {
+                        trans->x = fetched->x + (fetchedNext->x - fetched->x) * blend;
+                        trans->y = fetched->y + (fetchedNext->y - fetched->y) * blend;
+                        *priorities = *fetchedPriority + (*fetchedNextPriority - *fetchedPriority) * blend;
+                    }
+                    edges->p.x = x + trans->x;
+                    edges->p.y = y + trans->y;
+                    if (x > x1) {
+                        auto prev = edges - 1;
+                        vectorSubtract(edges->p, prev->p, &prev->vect);
+                        prev->isInitialised = false;
+                        prev->initialise();
+                    }
+                }
+            }
+        };
+
+        for (auto& srcRect : srcRects) {
+            auto corners = srcRect.x2 - srcRect.x1 + 1;
+            fetchedTrans.resize(corners);
+            fetchedNextTrans.resize(corners);
+            fetchedPriorities.resize(corners);
+            fetchedNextPriorities.resize(corners);
+            for (auto& rows : sampleRows) {
+                rows.resize(corners);
+            }
+            fetchRow(srcRect.y1, srcRect.x1, srcRect.x2);
+            for (p.y=srcRect.y1; p.y < srcRect.y2; p.y++) {
+                if (_effect->abort()) {return;}
+                // last row's bottoms are this row's tops
+                for (auto& rows : sampleRows) {
+                    rows.next();
+                }
+                fetchRow(p.y + 1, srcRect.x1, srcRect.x2);
+                for (auto& rows : sampleRows) {
+                    rows.initialiseColumnEdges();
+                }
+
+                int i = 0;
+                for (p.x=srcRect.x1; p.x < srcRect.x2; p.x++, i++) {
+                    for (auto& rows : sampleRows) {
+                        // establish quadrangle, corners anticlockwise from
+                        // the top left
+                        auto& trans0 = rows.trans[i];
+                        auto& trans1 = rows.trans[i + 1];
+                        auto& trans2 = rows.nextTrans[i + 1];
+                        auto& trans3 = rows.nextTrans[i];
+                        allSame = (
+                            trans0.x == trans1.x && trans0.y == trans1.y
+                            && trans1.x == trans2.x && trans1.y == trans2.y
+                            && trans2.x == trans3.x && trans2.y == trans3.y
+                        );
+                        priority = 0.25 * (
+                            rows.priorities[i] + rows.priorities[i + 1]
+                            + rows.nextPriorities[i + 1] + rows.nextPriorities[i]
+                        );
+                        if (!allSame) {
+                            quad.edges[0] = rows.edges[i];
+                            quad.edges[1] = rows.columnEdges[i + 1];
+                            quad.edges[2].initialiseReversed(rows.nextEdges[i], rows.nextEdges[i + 1].p);
+                            quad.edges[3].initialiseReversed(rows.columnEdges[i], rows.nextEdges[i].p);
+                        }
+
+                        // all the same? There's no distortion,
+                        // we just know whence to draw this pixel
+                        // Also if the quad is invalid, do the same.
+                        if (
+                            allSame
+                            || !quad.edges[0].isInitialised
+                            || !quad.edges[1].isInitialised
+                            || !quad.edges[2].isInitialised
+                            || !quad.edges[3].isInitialised
+                        ) {
+                            auto srcPIX = (float*)_srcImg->getPixelAddressNearest(p.x, p.y);
+                            buffer.add(rows.edges[i].p, srcPIX, 1, priority);
+                            continue;
+                        }
+
+                        // it's distorted, let's bblaaay
+                        // go through every pixel inside the smallest rect
+                        // containing this quadrangle, intersected with the band
+                        quad.bounds(&quadBounds);
+                        rectIntersect(&quadBounds, &band, &intersectBounds);
+
+                        // smooth translations mostly give near parallelograms,
+                        // which don't need cutting up
+                        if (affineQuad.initialise(quad)) {
+                            for (transPoint.y=intersectBounds.y1; transPoint.y < intersectBounds.y2; transPoint.y++) {
+                                for (transPoint.x=intersectBounds.x1; transPoint.x < intersectBounds.x2; transPoint.x++) {
+                                    intersection = affineQuad.coverage(transPoint);
+                                    if (intersection <= 0) {continue;}
+                                    affineQuad.identityPoint(transPoint, &srcPoint);
+                                    splat(intersection);
+                                }
+                            }
+                            continue;
+                        }
+
+                        // a row at a time, from just where the row's span touches,
+                        // so only the edge pixels get cut up
+                        QuadrangleRasteriser rasteriser(&quad);
+                        for (int y=intersectBounds.y1; y < intersectBounds.y2; y++) {
+                            rasteriser.rowSpan(y, &span);
+                            auto x1 = std::max(intersectBounds.x1, span.coverX1);
+                            auto x2 = std::min(intersectBounds.x2, span.coverX2);
+                            if (x1 >= x2) {continue;}
+                            rasteriser.rowSamples(y, x1, x2, rowCoverage.data(), rowIdentityPoints.data());
+                            transPoint.y = y;
+                            for (int x=x1; x < x2; x++) {
+                                intersection = rowCoverage[x - x1];
+                                if (intersection <= 0) {continue;}
+                                transPoint.x = x;
+                                srcPoint = rowIdentityPoints[x - x1];
+                                splat(intersection);
+                            }
+                        }
+                    }
+                }
             }
-            ratioSums[
-                (actualY - window.y1) * width + (actualX - window.x1)
-            ] += finalWeight;
         }
+
+        buffer.write(_dstImg);
     }
-}
+
+private:
+    // a sub-frame's streamed rows of corners:
+    // the translations, priorities and edges along the quads' tops and
+    // bottoms, and the edges down between them
+    class CornerRows {
+    public:
+        std::vector<OfxPointD> trans;
+        std::vector<OfxPointD> nextTrans;
+        std::vector<double> priorities;
+        std::vector<double> nextPriorities;
+        std::vector<Edge> edges;
+        std::vector<Edge> nextEdges;
+        std::vector<Edge> columnEdges;
+
+        void resize(int corners) {
+            trans.resize(corners);
+            nextTrans.resize(corners);
+            priorities.resize(corners);
+            nextPriorities.resize(corners);
+            edges.resize(corners);
+            nextEdges.resize(corners);
+            columnEdges.resize(corners);
+        }
+
+        void next() {
+            std::swap(trans, nextTrans);
+            std::swap(priorities, nextPriorities);
+            std::swap(edges, nextEdges);
+        }
+
+        void initialiseColumnEdges() {
+            for (size_t i=0; i < columnEdges.size(); i++) {
+                auto& columnEdge = columnEdges[i];
+                columnEdge.p = edges[i].p;
+                vectorSubtract(nextEdges[i].p, columnEdge.p, &columnEdge.vect);
+                columnEdge.isInitialised = false;
+                columnEdge.initialise();
+            }
+        }
+    };
+
+    ImageEffect* _effect;
+    Image* _transImg;
+    Image* _nextTransImg;
+    Image* _srcImg;
+    BilinearSampler _sampler;
+    Image* _dstImg;
+    const TranslateMapGrid* _grid;
+    OfxRectI _window;
+    OfxPointD _transScale;
+    int _samples;
+    double _shutter;
+    int _occlusion;
+    double _occlusionTolerance;
+};
+
+// Samples the source where each output pixel came from, by
+// TranslateMapInverse, a band of rows per thread. Pixels it can't find,
+// for landing on a fold or not settling, are left out like those landing
+// outside the source.
+// Given a pyramid, the source is sampled over each pixel's footprint,
+// from the slopes of the inverse where it's found.
+// For motion blur that's averaged over the sub-frames, with the
+// translations blended from transImg's towards nextTransImg's.
+class TranslateMapGatherProcessor : public MultiThread::Processor {
+public:
+    TranslateMapGatherProcessor(
+        ImageEffect* effect, Image* transImg, Image* nextTransImg,
+        Image* srcImg, const MipPyramid* pyramid, Image* dstImg, OfxRectI window, OfxPointD transScale,
+        int samples, double shutter
+    )
+    : _effect(effect)
+    , _transSampler(transImg)
+    , _nextTransSampler(nextTransImg)
+    , _srcImg(srcImg)
+    , _srcSampler(srcImg)
+    , _pyramid(pyramid)
+    , _dstImg(dstImg)
+    , _window(window)
+    , _inverse(transScale)
+    , _samples(std::max(1, samples))
+    , _shutter(shutter)
+    {}
+
+    void process() {
+        auto nThreads = std::max(1u, std::min(
+            MultiThread::getNumCPUs(), unsigned(std::max(1, _window.y2 - _window.y1))
+        ));
+        multiThread(nThreads);
+    }
+
+    virtual void multiThreadFunction(unsigned int threadIndex, unsigned int threadMax) OVERRIDE FINAL {
+        auto height = _window.y2 - _window.y1;
+        auto y1 = _window.y1 + int(height * double(threadIndex) / threadMax);
+        auto y2 = _window.y1 + int(height * double(threadIndex + 1) / threadMax);
+
+        auto srcROD = _srcImg->getRegionOfDefinition();
+        auto srcComponentCount = _srcImg->getPixelComponentCount();
+        auto dstComponentCount = _dstImg->getPixelComponentCount();
+        auto componentCount = std::min(srcComponentCount, dstComponentCount);
+        std::vector<float> values(srcComponentCount);
+        std::vector<float> sums(componentCount);
+
+        OfxPointD srcPoint;
+        double jacobian[2][2];
+        for (int y=y1; y < y2; y++) {
+            if (_effect->abort()) {return;}
+            auto dstPix = (float*)_dstImg->getPixelAddress(_window.x1, y);
+            if (!dstPix) {continue;}
+            for (int x=_window.x1; x < _window.x2; x++, dstPix += dstComponentCount) {
+                std::fill(sums.begin(), sums.end(), 0);
+                int accepted = 0;
+                for (int k=0; k < _samples; k++) {
+                    auto blend = _shutter * k / _samples;
+                    // nothing from where it can't be found, nor from outside the source
+                    if (
+                        !_invert(x, y, blend, &srcPoint, jacobian)
+                        || !(srcPoint.x >= srcROD.x1 && srcPoint.x < srcROD.x2)
+                        || !(srcPoint.y >= srcROD.y1 && srcPoint.y < srcROD.y2)
+                    ) {continue;}
+                    if (_pyramid) {
+                        _pyramid->sample(srcPoint.x, srcPoint.y, jacobian, values.data());
+                    } else {
+                        _srcSampler.sample(srcPoint.x, srcPoint.y, values.data());
+                    }
+                    for (int c=0; c < componentCount; c++) {
+                        sums[c] += values[c];
+                    }
+                    accepted++;
+                }
+                // averaged over the sub-samples that landed in the source,
+                // so a pixel half blurred off the edge or a fold isn't darkened
+                for (int c=0; c < dstComponentCount; c++) {
+                    dstPix[c] = c < componentCount && accepted > 0 ? sums[c] / accepted : 0;
+                }
+            }
+        }
+    }
+
+private:
+    // s for the pixel at x,y, and its slopes, false if it can't be found
+    bool _invert(double x, double y, double blend, OfxPointD* srcPoint, double jacobian[2][2]) const {
+        auto slopes = [&](double sx, double sy, float* trans, float* transDx, float* transDy) {
+            _transSampler.sampleSlopes(sx, sy, 2, trans, transDx, transDy);
+            if (!(blend > 0)) {return;}
+            float nextTrans[2], nextTransDx[2], nextTransDy[2];
+            _nextTransSampler.sampleSlopes(sx, sy, 2, nextTrans, nextTransDx, nextTransDy);
+            for (int c=0; c < 2; c++) {
+                trans[c] += (nextTrans[c] - trans[c]) * blend;
+                transDx[c] += (nextTransDx[c] - transDx[c]) * blend;
+                transDy[c] += (nextTransDy[c] - transDy[c]) * blend;
+            }
+        };
+        return _inverse.invert(slopes, {x, y}, srcPoint, jacobian);
+    }
+
+    ImageEffect* _effect;
+    BilinearSampler _transSampler;
+    BilinearSampler _nextTransSampler;
+    Image* _srcImg;
+    BilinearSampler _srcSampler;
+    const MipPyramid* _pyramid;
+    Image* _dstImg;
+    OfxRectI _window;
+    TranslateMapInverse _inverse;
+    int _samples;
+    double _shutter;
+};
 
 // the overridden render function
 void TranslateMapPlugin::render(const RenderArguments &args)
@@ -108,141 +595,97 @@ void TranslateMapPlugin::render(const RenderArguments &args)
         _transClip->fetchImage(args.time, _transClip->getRegionOfDefinition(args.time))
     );
     if (!transImg.get()) {return;}
-    auto transROD = transImg->getRegionOfDefinition();
     auto trans_component_count = transImg->getPixelComponentCount();
     if (trans_component_count < 2) {return;}
     auto_ptr<Image> srcImg(_srcClip->fetchImage(args.time));
     auto srcROD = srcImg->getRegionOfDefinition();
-    auto srcComponentCount = srcImg->getPixelComponentCount();
     auto srcPar = srcImg->getPixelAspectRatio();
     auto_ptr<Image> dstImg(_dstClip->fetchImage(args.time));
-    auto dstComponentCount = dstImg->getPixelComponentCount();
-    auto componentCount = std::min(
-        srcComponentCount, dstComponentCount
-    );
 
-    float* outPIX;
-
-    // start entire output at 0
-    // initialise all the sums of ratios for each output pixel
-    auto windowWidth = args.renderWindow.x2 - args.renderWindow.x1;
-    auto windowHeight = args.renderWindow.y2 - args.renderWindow.y1;
-    auto_ptr<double> ratioSums(new double[windowHeight * windowWidth]);
-    auto ratioSumsPtr = ratioSums.get();
-    for (int y=args.renderWindow.y1; y < args.renderWindow.y2; y++) {
-        for (int x=args.renderWindow.x1; x < args.renderWindow.x2; x++, ratioSumsPtr++) {
-            *ratioSumsPtr = 0;
-            outPIX = (float*)dstImg->getPixelAddress(x, y);
-            for (int c=0; c < dstComponentCount; c++, outPIX++) {
-                *outPIX = 0;
-            }
-        }
-    }
-
-    OfxPointD p;
-    OfxPointD transVect;
-    OfxPointD prevTransVect;
-    OfxPointD cornerPoint;
-    bool allSame;
-    Quadrangle quad;
-    OfxRectI quadBounds;
-    OfxRectI intersectBounds;
-    OfxPointD transPoint;
-    float* transPIX;
-    OfxPointD srcPoint;
-    double intersection;
-    auto_ptr<float> values(new float[componentCount]);
-    for (p.y=srcROD.y1; p.y < srcROD.y2; p.y++) {
-        for (p.x=srcROD.x1; p.x < srcROD.x2; p.x++) {
-            if (abort()) {return;}
-            // establish quadrangle points
-            allSame = true;
-            auto edgePtr = quad.edges;
-            for (int i=0; i < 4; i++, edgePtr++) {
-                cornerPoint.x = p.x + (i % 3); // 1 and 2
-                cornerPoint.y = p.y + (i >> 1); // 2 and 3
-                transPIX = (float*)transImg->getPixelAddressNearest(
-                    cornerPoint.x, cornerPoint.y
-                );
-                transVect.x = transPIX[0] * args.renderScale.x / srcPar;
-                transVect.y = transPIX[1] * args.renderScale.y;
-                if (i > 0) {
-                    // so far all same and same as last one
-                    allSame = (
-                        allSame
-                        && transVect.x == prevTransVect.x
-                        && transVect.y == prevTransVect.y
-                    );
-                }
-                prevTransVect = transVect;
-                vectorAdd(cornerPoint, transVect, &edgePtr->p);
-            }
+    OfxPointD transScale = {args.renderScale.x / srcPar, args.renderScale.y};
 
-            // all the same? There's no distortion,
-            // we just know whence to draw this pixel
-            // Also if the quad is invalid, do the same.
-            // I have good reason to believe initialise won't be
-            // call if allSame is true
-            if (allSame || !quad.initialise()) {
-                auto srcPIX = (float*)srcImg->getPixelAddressNearest(p.x, p.y);
-                addPixelValue(
-                    quad.edges[0].p, srcPIX, componentCount, 1,
-                    dstImg.get(), ratioSums.get(), args.renderWindow
-                );
-                continue;
-            }
+    // motion blur blends towards the next frame's translations
+    auto samples = _motionBlurSamples->getValueAtTime(args.time);
+    auto shutter = _shutter->getValueAtTime(args.time);
+    auto_ptr<Image> nextTransImg;
+    if (samples > 1 && shutter > 0) {
+        nextTransImg.reset(_transClip->fetchImage(
+            args.time + 1, _transClip->getRegionOfDefinition(args.time + 1)
+        ));
+    }
+    if (!nextTransImg.get() || nextTransImg->getPixelComponentCount() < 2) {
+        nextTransImg.reset();
+        samples = 1;
+    }
+    auto otherTransImg = nextTransImg.get() ? nextTransImg.get() : transImg.get();
 
-            // it's distorted, let's bblaaay
-            // go through every pixel inside the smallest rect
-            // containing this quadrangle, intersected with render window
-            quad.bounds(&quadBounds);
-            rectIntersect(&quadBounds, &args.renderWindow, &intersectBounds);
-            for (transPoint.y=intersectBounds.y1; transPoint.y < intersectBounds.y2; transPoint.y++) {
-                for (transPoint.x=intersectBounds.x1; transPoint.x < intersectBounds.x2; transPoint.x++) {
-                    if (abort()) {return;}
-                    QuadranglePixel quadPix(&quad, transPoint);
-                    if (transPoint.x == 1422 && transPoint.y == 429) {
-                        std::cout << quadPix.intersection << std::endl;
-                    }
-                    if (quadPix.intersection <= 0) {continue;}
-                    quadPix.calculateIdentityPoint(&srcPoint);
-                    if (transPoint.x == 1422 && transPoint.y == 429) {
-                        std::cout << srcPoint.x << "," << srcPoint.y << std::endl;
-                    }
-                    if (
-                        IsNaN(srcPoint.x)
-                        || IsNaN(srcPoint.y)
-                    ) {
-                        srcPoint.x = 0;
-                        srcPoint.y = 0;
-                    }
-                    if (srcPoint.x < 0) {srcPoint.x = 0;}
-                    if (srcPoint.x >= 1) {srcPoint.x = 1 - QUADRANGLEDISTORT_DELTA;}
-                    if (srcPoint.y < 0) {srcPoint.y = 0;}
-                    if (srcPoint.y >= 1) {srcPoint.y = 1 - QUADRANGLEDISTORT_DELTA;}
-                    srcPoint.x += p.x;
-                    srcPoint.y += p.y;
-                    bilinear(
-                        srcPoint.x, srcPoint.y, srcImg.get(), values.get(), componentCount
-                    );
-                    addPixelValue(
-                        transPoint, values.get(), componentCount, quadPix.intersection,
-                        dstImg.get(), ratioSums.get(), args.renderWindow
-                    );
-                }
-            }
+    if (_mode->getValueAtTime(args.time) == 1) {
+        // shared by the render window's threads, and by the frame's other tiles
+        std::shared_ptr<const MipPyramid> pyramid;
+        if (_filter->getValueAtTime(args.time) == 1) {
+            pyramid = getPyramid(srcImg.get());
         }
+        TranslateMapGatherProcessor(
+            this, transImg.get(), otherTransImg, srcImg.get(), pyramid.get(), dstImg.get(),
+            args.renderWindow, transScale, samples, shutter
+        ).process();
+        return;
     }
+    auto grid = getGrid(args.time, transImg.get(), nextTransImg.get(), srcROD, transScale);
+    TranslateMapProcessor(
+        this, transImg.get(), otherTransImg, srcImg.get(), dstImg.get(), grid.get(),
+        args.renderWindow, transScale, samples, shutter,
+        _occlusion->getValueAtTime(args.time),
+        _occlusionTolerance->getValueAtTime(args.time)
+    ).process();
+}
 
-    ratioSumsPtr = ratioSums.get();
-    for (int y=args.renderWindow.y1; y < args.renderWindow.y2; y++) {
-        for (int x=args.renderWindow.x1; x < args.renderWindow.x2; x++, ratioSumsPtr++) {
-            if (abort()) {return;}
-            if (*ratioSumsPtr == 0) {continue;}
-            outPIX = (float*)dstImg->getPixelAddress(x, y);
-            for (int c=0; c < componentCount; c++, outPIX++) {
-                *outPIX /= *ratioSumsPtr;
-            }
-        }
+std::shared_ptr<const TranslateMapGrid> TranslateMapPlugin::getGrid(
+    double time, Image* transImg, Image* nextTransImg, OfxRectI srcROD, OfxPointD transScale
+) {
+    // the host changes an image's identifier whenever its pixels change.
+    // Without one there's nothing to tell translations from the last, so it's built every time.
+    auto transId = transImg->getUniqueIdentifier();
+    auto nextTransId = nextTransImg ? nextTransImg->getUniqueIdentifier() : std::string();
+    if (transId.empty() || (nextTransImg && nextTransId.empty())) {
+        return std::make_shared<const TranslateMapGrid>(transImg, nextTransImg, srcROD, transScale);
+    }
+    auto transIds = transId + "\n" + nextTransId;
+    std::lock_guard<std::mutex> guard(_gridLock);
+    if (
+        !_grid || time != _gridTime || transIds != _gridTransIds
+        || transScale.x != _gridTransScale.x || transScale.y != _gridTransScale.y
+        || srcROD.x1 != _gridSrcROD.x1 || srcROD.y1 != _gridSrcROD.y1
+        || srcROD.x2 != _gridSrcROD.x2 || srcROD.y2 != _gridSrcROD.y2
+    ) {
+        _grid = std::make_shared<const TranslateMapGrid>(transImg, nextTransImg, srcROD, transScale);
+        _gridTime = time;
+        _gridTransScale = transScale;
+        _gridSrcROD = srcROD;
+        _gridTransIds = transIds;
+    }
+    return _grid;
+}
+
+std::shared_ptr<const MipPyramid> TranslateMapPlugin::getPyramid(Image* srcImg) {
+    // the host changes an image's identifier whenever its pixels change.
+    // Without one there's nothing to tell a source from the last, so it's built every time.
+    auto sourceId = srcImg->getUniqueIdentifier();
+    if (sourceId.empty()) {
+        return std::make_shared<const MipPyramid>(srcImg);
+    }
+    auto bounds = srcImg->getBounds();
+    std::lock_guard<std::mutex> guard(_pyramidLock);
+    if (
+        !_pyramid || sourceId != _pyramidSourceId
+        || bounds.x1 != _pyramidBounds.x1 || bounds.y1 != _pyramidBounds.y1
+        || bounds.x2 != _pyramidBounds.x2 || bounds.y2 != _pyramidBounds.y2
+    ) {
+        // dropped first, so the last one and its replacement aren't both held
+        _pyramid.reset();
+        _pyramid = std::make_shared<const MipPyramid>(srcImg);
+        _pyramidSourceId = sourceId;
+        _pyramidBounds = bounds;
     }
+    return _pyramid;
 }
@@ -1,6 +1,11 @@
 #include "ofxsImageEffect.h"
 #include "ofxsMacros.h"
+#include "../QuadrangleDistort/MipPyramid.h"
+#include "TranslateMapGrid.h"
+#include "TranslateMapInverse.h"
 #include <iostream>
+#include <memory>
+#include <mutex>
 
 using namespace OFX;
 
@@ -16,8 +21,36 @@ using namespace OFX;
 #define kSourceClip "Source"
 #define kTranslationsClip "Translations"
 
+#define kParamMode "mode"
+#define kParamModeLabel "Mode"
+#define kParamModeHint "Splat draws each source pixel where it's translated to, so any translations work, folds and all. Gather looks up where each output pixel came from, which is much quicker and copes with any stretching or turning, but where the translations fold over themselves it shows one layer at most"
+
+#define kParamFilter "filter"
+#define kParamFilterLabel "Filter"
+#define kParamFilterHint "Bilinear samples the source at a single point per pixel, which shimmers where it's shrunk a lot. Mipmap samples a prefiltered copy of the source sized to each pixel's footprint, along the way it's stretched. Gather only"
+
+#define kParamMotionBlurSamples "motionBlurSamples"
+#define kParamMotionBlurSamplesLabel "Motion Blur Samples"
+#define kParamMotionBlurSamplesHint "How many sub-frames to splat, the translations blended between this frame's and the next's. 1 is no motion blur"
+
+#define kParamShutter "shutter"
+#define kParamShutterLabel "Shutter"
+#define kParamShutterHint "How much of the way to the next frame the shutter's open for, as the sub-frames spread"
+
+#define kParamOcclusion "occlusion"
+#define kParamOcclusionLabel "Occlusion"
+#define kParamOcclusionHint "Where the translations fold, which of the source landing on the same place is in front. None averages them all. Blue puts the highest blue of the Translations in front, and Displacement the furthest translated. Splat only"
+
+#define kParamOcclusionTolerance "occlusionTolerance"
+#define kParamOcclusionToleranceLabel "Occlusion Tolerance"
+#define kParamOcclusionToleranceHint "How far behind the front, in blue or translation, source can be and still be blended in rather than hidden"
+
 #define MAX_CACHE_OUTPUTS 10
 
+// how far, in pixels, a quad's corners can be from a parallelogram's
+// for it to be splatted as one
+#define AFFINE_QUAD_TOLERANCE 0.01
+
 
 class TranslateMapPlugin : public ImageEffect
 {
@@ -35,12 +68,40 @@ private:
 #endif
     ) OVERRIDE FINAL;
 
+    virtual void getFramesNeeded(const FramesNeededArguments &args, FramesNeededSetter &frames) OVERRIDE FINAL;
+
     virtual void getClipPreferences(ClipPreferencesSetter &clipPreferences) OVERRIDE FINAL;
 
     virtual void getRegionsOfInterest(const RegionsOfInterestArguments &args, RegionOfInterestSetter &rois);
 
+    std::shared_ptr<const TranslateMapGrid> getGrid(
+        double time, Image* transImg, Image* nextTransImg, OfxRectI srcROD, OfxPointD transScale
+    );
+
+    std::shared_ptr<const QuadrangleDistort::MipPyramid> getPyramid(Image* srcImg);
+
 private:
     Clip* _srcClip;
     Clip* _transClip;
     Clip* _dstClip;
+    ChoiceParam* _mode;
+    ChoiceParam* _filter;
+    IntParam* _motionBlurSamples;
+    DoubleParam* _shutter;
+    ChoiceParam* _occlusion;
+    DoubleParam* _occlusionTolerance;
+
+    // the last frame's grid, so its tiles don't each scan all its translations
+    std::shared_ptr<const TranslateMapGrid> _grid;
+    double _gridTime;
+    OfxPointD _gridTransScale;
+    OfxRectI _gridSrcROD;
+    std::string _gridTransIds;
+    std::mutex _gridLock;
+
+    // the last source's pyramid, so tiles of a frame share one
+    std::shared_ptr<const QuadrangleDistort::MipPyramid> _pyramid;
+    std::string _pyramidSourceId;
+    OfxRectI _pyramidBounds;
+    std::mutex _pyramidLock;
 };
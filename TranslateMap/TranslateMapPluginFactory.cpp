@@ -18,8 +18,8 @@ void TranslateMapPluginFactory::describe(ImageEffectDescriptor &desc)
     desc.setSingleInstance(false);
     desc.setHostFrameThreading(false);
     desc.setSupportsMultiResolution(true);
-    desc.setSupportsTiles(false);
-    desc.setTemporalClipAccess(false);
+    desc.setSupportsTiles(true);
+    desc.setTemporalClipAccess(true);
     desc.setRenderTwiceAlways(false);
     desc.setSupportsMultipleClipPARs(true);
     desc.setSupportsMultipleClipDepths(false);
@@ -32,7 +32,7 @@ void TranslateMapPluginFactory::describeInContext(ImageEffectDescriptor &desc, C
     // create the mandated translations clip
     ClipDescriptor *transClip = desc.defineClip(kTranslationsClip);
     transClip->addSupportedComponent(ePixelComponentRGB);
-    transClip->setTemporalClipAccess(false);
+    transClip->setTemporalClipAccess(true);
     transClip->setSupportsTiles(true);
     transClip->setIsMask(false);
 
@@ -42,7 +42,7 @@ void TranslateMapPluginFactory::describeInContext(ImageEffectDescriptor &desc, C
     srcClip->addSupportedComponent(ePixelComponentRGB);
     srcClip->addSupportedComponent(ePixelComponentAlpha);
     srcClip->setTemporalClipAccess(false);
-    srcClip->setSupportsTiles(false);
+    srcClip->setSupportsTiles(true);
     srcClip->setIsMask(false);
 
     // create the mandated output clip
@@ -51,7 +51,76 @@ void TranslateMapPluginFactory::describeInContext(ImageEffectDescriptor &desc, C
     dstClip->addSupportedComponent(ePixelComponentRGBA);
     srcClip->addSupportedComponent(ePixelComponentAlpha);
     dstClip->setTemporalClipAccess(false);
-    dstClip->setSupportsTiles(false);
+    dstClip->setSupportsTiles(true);
+
+    PageParamDescriptor *page = desc.definePageParam("Controls");
+    {
+        auto param = desc.defineChoiceParam(kParamMode);
+        param->setLabel(kParamModeLabel);
+        param->setHint(kParamModeHint);
+        param->appendOption("Splat");
+        param->appendOption("Gather");
+        param->setAnimates(false);
+        if (page) {
+            page->addChild(*param);
+        }
+    }
+    {
+        auto param = desc.defineChoiceParam(kParamFilter);
+        param->setLabel(kParamFilterLabel);
+        param->setHint(kParamFilterHint);
+        param->appendOption("Bilinear");
+        param->appendOption("Mipmap");
+        param->setAnimates(false);
+        if (page) {
+            page->addChild(*param);
+        }
+    }
+    {
+        auto param = desc.defineIntParam(kParamMotionBlurSamples);
+        param->setLabel(kParamMotionBlurSamplesLabel);
+        param->setHint(kParamMotionBlurSamplesHint);
+        param->setDefault(1);
+        param->setRange(1, 64);
+        param->setDisplayRange(1, 16);
+        if (page) {
+            page->addChild(*param);
+        }
+    }
+    {
+        auto param = desc.defineDoubleParam(kParamShutter);
+        param->setLabel(kParamShutterLabel);
+        param->setHint(kParamShutterHint);
+        param->setDefault(0.5);
+        param->setRange(0, 1);
+        param->setDisplayRange(0, 1);
+        if (page) {
+            page->addChild(*param);
+        }
+    }
+    {
+        auto param = desc.defineChoiceParam(kParamOcclusion);
+        param->setLabel(kParamOcclusionLabel);
+        param->setHint(kParamOcclusionHint);
+        param->appendOption("None");
+        param->appendOption("Blue");
+        param->appendOption("Displacement");
+        param->setAnimates(false);
+        if (page) {
+            page->addChild(*param);
+        }
+    }
+    {
+        auto param = desc.defineDoubleParam(kParamOcclusionTolerance);
+        param->setLabel(kParamOcclusionToleranceLabel);
+        param->setHint(kParamOcclusionToleranceHint);
+        param->setDefault(0.1);
+        param->setRange(0, 1000000);
+        param->setDisplayRange(0, 10);
+        if (page) {
+            page->addChild(*param);
+        }
+    }
 }
 
 ImageEffect* TranslateMapPluginFactory::createInstance(OfxImageEffectHandle handle, ContextEnum /*context*/)
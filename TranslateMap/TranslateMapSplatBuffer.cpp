@@ -0,0 +1,45 @@
+#include "TranslateMapSplatBuffer.h"
+#include <algorithm>
+#include <limits>
+
+
+TranslateMapSplatBuffer::TranslateMapSplatBuffer(
+    OfxRectI band, int componentCount, bool occlusion, double occlusionTolerance
+)
+: _band(band)
+, _width(std::max(0, band.x2 - band.x1))
+, _componentCount(componentCount)
+, _stride(componentCount + 1)
+, _sums(size_t(std::max(0, band.y2 - band.y1)) * _width * _stride, 0)
+, _occlusion(occlusion)
+, _occlusionTolerance(std::max(0.0, occlusionTolerance))
+, _fronts(
+    occlusion ? size_t(std::max(0, band.y2 - band.y1)) * _width : 0,
+    -std::numeric_limits<float>::infinity()
+)
+{}
+
+void TranslateMapSplatBuffer::write(Image* dstImg) const {
+    auto dstComponentCount = dstImg->getPixelComponentCount();
+    auto componentCount = std::min(_componentCount, dstComponentCount);
+    auto sums = _sums.data();
+    for (int y=_band.y1; y < _band.y2; y++) {
+        auto dstPix = (float*)dstImg->getPixelAddress(_band.x1, y);
+        if (!dstPix) {
+            sums += size_t(_width) * _stride;
+            continue;
+        }
+        for (int x=_band.x1; x < _band.x2; x++, sums += _stride, dstPix += dstComponentCount) {
+            auto weight = sums[_componentCount];
+            int c = 0;
+            if (weight != 0) {
+                for (; c < componentCount; c++) {
+                    dstPix[c] = sums[c] / weight;
+                }
+            }
+            for (; c < dstComponentCount; c++) {
+                dstPix[c] = 0;
+            }
+        }
+    }
+}
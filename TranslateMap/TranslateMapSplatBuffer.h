@@ -0,0 +1,84 @@
+#ifndef TRANSLATEMAPSPLATBUFFER_H
+#define TRANSLATEMAPSPLATBUFFER_H
+
+#include "ofxsImageEffect.h"
+#include <cmath>
+#include <vector>
+
+using namespace OFX;
+
+
+// Where a band of the output is splatted into before it's written out.
+// Each pixel is its weighted sums of components followed by its sum of
+// weights, all in one contiguous buffer, so a contribution is an offset
+// away rather than a trip through the host's image.
+// With occlusion each pixel also keeps the priority of what's in front.
+// Anything higher by more than the tolerance replaces what's there,
+// anything lower by more is dropped, and in between is blended in.
+class TranslateMapSplatBuffer {
+public:
+    TranslateMapSplatBuffer(
+        OfxRectI band, int componentCount,
+        bool occlusion = false, double occlusionTolerance = 0
+    );
+
+    // p's values into the pixels around it, bilinearly if it's between them.
+    // Anything outside the band is dropped.
+    inline void add(OfxPointD p, const float* values, double weight, double priority = 0) {
+        int floorX = floor(p.x);
+        int floorY = floor(p.y);
+        if (p.x == floorX && p.y == floorY) {
+            _addAt(floorX, floorY, values, weight, priority);
+            return;
+        }
+        double weightX = p.x - floorX;
+        double weightY = p.y - floorY;
+        _addAt(floorX, floorY, values, (1 - weightX) * (1 - weightY) * weight, priority);
+        _addAt(floorX + 1, floorY, values, weightX * (1 - weightY) * weight, priority);
+        _addAt(floorX, floorY + 1, values, (1 - weightX) * weightY * weight, priority);
+        _addAt(floorX + 1, floorY + 1, values, weightX * weightY * weight, priority);
+    }
+
+    // the band's sums over their weights into dstImg,
+    // with nothing where nothing landed
+    void write(Image* dstImg) const;
+
+private:
+    inline void _addAt(int x, int y, const float* values, float weight, double priority) {
+        if (
+            x < _band.x1 || x >= _band.x2
+            || y < _band.y1 || y >= _band.y2
+            || weight == 0
+        ) {return;}
+        auto index = size_t(y - _band.y1) * _width + (x - _band.x1);
+        auto sums = _sums.data() + index * _stride;
+        if (_occlusion) {
+            auto& front = _fronts[index];
+            if (priority > front + _occlusionTolerance) {
+                // in front of everything so far
+                front = priority;
+                for (int c=0; c <= _componentCount; c++) {
+                    sums[c] = 0;
+                }
+            } else if (priority < front - _occlusionTolerance) {
+                return;
+            }
+        }
+        for (int c=0; c < _componentCount; c++) {
+            sums[c] += values[c] * weight;
+        }
+        sums[_componentCount] += weight;
+    }
+
+    OfxRectI _band;
+    int _width;
+    int _componentCount;
+    int _stride;
+    std::vector<float> _sums;
+    bool _occlusion;
+    double _occlusionTolerance;
+    // per pixel priority of what's in front, only with occlusion
+    std::vector<float> _fronts;
+};
+
+#endif // def TRANSLATEMAPSPLATBUFFER_H
@@ -0,0 +1,232 @@
+#include "../TranslateMapInverse.h"
+#include "../../QuadrangleDistort/QuadrangleDistort.h"
+#include <algorithm>
+#include <cstdio>
+#include <functional>
+#include <vector>
+
+// source pixels along each side of the translations
+#define TEST_SIZE 48
+// output points tried along each side, between the translated corners
+#define TEST_POINTS 160
+// GATHER_TOLERANCE in the output, back through the stretching
+#define SOURCE_TOLERANCE 0.005
+// the splat's slopes are taken over this step of the output
+#define SLOPE_STEP 1e-4
+#define SLOPE_TOLERANCE 1e-3
+
+using namespace QuadrangleDistort;
+
+
+// The Support library wants the plugins to list their factories,
+// and there aren't any here.
+void OFX::Plugin::getPluginIDs(OFX::PluginFactoryArray& /*ids*/) {}
+
+namespace {
+    int _failures = 0;
+
+    void _check(bool ok, const char* what, const char* field, double error) {
+        if (ok) {return;}
+        if (_failures < 20) {
+            printf("FAIL %s, %s field, error %g\n", what, field, error);
+        }
+        _failures++;
+    }
+
+    // translations at each source pixel, looked up as BilinearSampler does
+    class Translations {
+    public:
+        Translations(std::function<OfxPointD(double, double)> field) : _values(TEST_SIZE * TEST_SIZE) {
+            for (int y=0; y < TEST_SIZE; y++) {
+                for (int x=0; x < TEST_SIZE; x++) {
+                    _values[y * TEST_SIZE + x] = field(x, y);
+                }
+            }
+        }
+
+        inline OfxPointD at(int x, int y) const {
+            x = std::max(0, std::min(TEST_SIZE - 1, x));
+            y = std::max(0, std::min(TEST_SIZE - 1, y));
+            return _values[y * TEST_SIZE + x];
+        }
+
+        void slopes(double x, double y, float* trans, float* transDx, float* transDy) const {
+            auto floorX = floor(x);
+            auto floorY = floor(y);
+            auto weightX = x - floorX;
+            auto weightY = y - floorY;
+            auto p00 = at(floorX, floorY);
+            auto p10 = at(floorX + 1, floorY);
+            auto p01 = at(floorX, floorY + 1);
+            auto p11 = at(floorX + 1, floorY + 1);
+            double v00[2] = {p00.x, p00.y};
+            double v10[2] = {p10.x, p10.y};
+            double v01[2] = {p01.x, p01.y};
+            double v11[2] = {p11.x, p11.y};
+            for (int c=0; c < 2; c++) {
+                auto bottom = v00[c] + weightX * (v10[c] - v00[c]);
+                auto top = v01[c] + weightX * (v11[c] - v01[c]);
+                trans[c] = bottom + weightY * (top - bottom);
+                transDx[c] = v10[c] - v00[c] + weightY * (v11[c] - v01[c] - v10[c] + v00[c]);
+                transDy[c] = top - bottom;
+            }
+        }
+
+    private:
+        std::vector<OfxPointD> _values;
+    };
+
+    // The quad the splat draws source pixel x,y's cell as,
+    // from its translated corners.
+    bool _splatQuad(const Translations& translations, OfxPointD transScale, int x, int y, Quadrangle* quad) {
+        OfxPointI corners[4] = {{x, y}, {x + 1, y}, {x + 1, y + 1}, {x, y + 1}};
+        for (int i=0; i < 4; i++) {
+            auto trans = translations.at(corners[i].x, corners[i].y);
+            quad->edges[i].p = {
+                corners[i].x + trans.x * transScale.x,
+                corners[i].y + trans.y * transScale.y
+            };
+        }
+        return quad->initialise();
+    }
+
+    bool _isInside(const Quadrangle& quad, OfxPointD p) {
+        for (int i=0; i < 4; i++) {
+            auto& edge = quad.edges[i];
+            if ((p.x - edge.p.x) * edge.norm.x + (p.y - edge.p.y) * edge.norm.y < 0) {return false;}
+        }
+        return true;
+    }
+
+    // Every output point the splat draws from the source's inside should
+    // be found by TranslateMapInverse, at the source point the splat took,
+    // with the slopes of the splat's source points there.
+    void _testAgainstSplat(const char* name, OfxPointD transScale, std::function<OfxPointD(double, double)> field) {
+        Translations translations(field);
+        auto slopes = [&](double x, double y, float* trans, float* transDx, float* transDy) {
+            translations.slopes(x, y, trans, transDx, transDy);
+        };
+        TranslateMapInverse inverse(transScale);
+
+        std::vector<Quadrangle> quads;
+        std::vector<OfxPointI> cells;
+        OfxRectD bounds = {INFINITY, INFINITY, -INFINITY, -INFINITY};
+        Quadrangle quad;
+        for (int y=0; y < TEST_SIZE - 1; y++) {
+            for (int x=0; x < TEST_SIZE - 1; x++) {
+                if (!_splatQuad(translations, transScale, x, y, &quad)) {continue;}
+                quads.push_back(quad);
+                cells.push_back({x, y});
+                for (auto& edge : quad.edges) {
+                    bounds.x1 = std::min(bounds.x1, edge.p.x);
+                    bounds.y1 = std::min(bounds.y1, edge.p.y);
+                    bounds.x2 = std::max(bounds.x2, edge.p.x);
+                    bounds.y2 = std::max(bounds.y2, edge.p.y);
+                }
+            }
+        }
+
+        int tested = 0;
+        int missed = 0;
+        double worst = 0;
+        double worstSlope = 0;
+        OfxPointD p, idP, idPX, idPY, srcPoint;
+        double jacobian[2][2];
+        for (int j=0; j < TEST_POINTS; j++) {
+            p.y = bounds.y1 + (bounds.y2 - bounds.y1) * (j + 0.37) / TEST_POINTS;
+            for (int i=0; i < TEST_POINTS; i++) {
+                p.x = bounds.x1 + (bounds.x2 - bounds.x1) * (i + 0.61) / TEST_POINTS;
+                for (size_t q=0; q < quads.size(); q++) {
+                    if (!_isInside(quads[q], p)) {continue;}
+                    QuadrangleInverse quadInverse(&quads[q]);
+                    quadInverse.identityPoint(p, &idP);
+                    quadInverse.identityPoint({p.x + SLOPE_STEP, p.y}, &idPX);
+                    quadInverse.identityPoint({p.x, p.y + SLOPE_STEP}, &idPY);
+                    tested++;
+                    if (!inverse.invert(slopes, p, &srcPoint, jacobian)) {
+                        missed++;
+                        break;
+                    }
+                    worst = std::max(worst, std::max(
+                        fabs(srcPoint.x - (cells[q].x + idP.x)),
+                        fabs(srcPoint.y - (cells[q].y + idP.y))
+                    ));
+                    // the slopes jump between cells, and it can settle just over the border
+                    if (floor(srcPoint.x) != cells[q].x || floor(srcPoint.y) != cells[q].y) {break;}
+                    worstSlope = std::max(worstSlope, std::max({
+                        fabs(jacobian[0][0] - (idPX.x - idP.x) / SLOPE_STEP),
+                        fabs(jacobian[1][0] - (idPX.y - idP.y) / SLOPE_STEP),
+                        fabs(jacobian[0][1] - (idPY.x - idP.x) / SLOPE_STEP),
+                        fabs(jacobian[1][1] - (idPY.y - idP.y) / SLOPE_STEP)
+                    }));
+                    break;
+                }
+            }
+        }
+        printf("%s: %d points, %d missed, worst %g, worst slope %g\n", name, tested, missed, worst, worstSlope);
+        _check(tested > TEST_POINTS * TEST_POINTS / 4, "enough points land in the splat", name, tested);
+        _check(missed == 0, "inverse finds every point the splat draws", name, missed);
+        _check(worst <= SOURCE_TOLERANCE, "inverse matches the splat's source point", name, worst);
+        _check(worstSlope <= SLOPE_TOLERANCE, "inverse's jacobian matches the splat's slopes", name, worstSlope);
+    }
+
+    void _testGather() {
+        double centre = (TEST_SIZE - 1) / 2.0;
+        _testAgainstSplat("expanding by 1.9", {1, 1}, [&](double x, double y) {
+            return OfxPointD{0.9 * (x - centre), 0.9 * (y - centre)};
+        });
+        // at half render scale, the translations in full size pixels
+        _testAgainstSplat("turning 70 degrees", {0.5, 0.5}, [&](double x, double y) {
+            auto angle = 70 * M_PI / 180;
+            auto dx = x - centre;
+            auto dy = y - centre;
+            return OfxPointD{
+                2 * (cos(angle) * dx - sin(angle) * dy - dx),
+                2 * (sin(angle) * dx + cos(angle) * dy - dy)
+            };
+        });
+        _testAgainstSplat("shrinking to 0.4", {1, 1}, [&](double x, double y) {
+            return OfxPointD{-0.6 * (x - centre), -0.6 * (y - centre)};
+        });
+        _testAgainstSplat("swirling", {1, 1}, [&](double x, double y) {
+            auto dx = x - centre;
+            auto dy = y - centre;
+            auto angle = 1.5 * exp(-(dx * dx + dy * dy) / (2 * 12 * 12));
+            return OfxPointD{
+                cos(angle) * dx - sin(angle) * dy - dx,
+                sin(angle) * dx + cos(angle) * dy - dy
+            };
+        });
+
+        // translations that turn the source over can't be inverted,
+        // though beyond the edges, where they're held, they can
+        Translations mirror([&](double x, double /*y*/) {
+            return OfxPointD{-2 * (x - centre), 0};
+        });
+        auto mirrorSlopes = [&](double x, double y, float* trans, float* transDx, float* transDy) {
+            mirror.slopes(x, y, trans, transDx, transDy);
+        };
+        TranslateMapInverse inverse({1, 1});
+        OfxPointD srcPoint;
+        int found = 0;
+        for (int i=0; i < TEST_POINTS; i++) {
+            if (
+                inverse.invert(mirrorSlopes, {i * double(TEST_SIZE) / TEST_POINTS + 0.3, centre}, &srcPoint)
+                && srcPoint.x >= 0 && srcPoint.x <= TEST_SIZE - 1
+            ) {
+                found++;
+            }
+        }
+        _check(found == 0, "inverse leaves out turned over translations", "mirror", found);
+    }
+}
+
+int main() {
+    _testGather();
+    if (_failures) {
+        printf("%d checks failed\n", _failures);
+        return 1;
+    }
+    printf("all checks passed\n");
+    return 0;
+}